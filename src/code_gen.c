@@ -56,6 +56,24 @@ static void print_version(void)
     fprintf(stderr, "Use -h for usage help and see https://triq.org/ for documentation.\n");
 }
 
+#define MAX_OUTPUTS 64
+#define MAX_EMITTERS 256
+
+/// Copy the output tones of the last parse for an emitter.
+static tone_t *take_tones(symbol_t const *symbols)
+{
+    size_t n = 0;
+    while (symbols[0].tone[n].us || symbols[0].tone[n].hz)
+        n++;
+    tone_t *tones = malloc((n + 1) * sizeof(*tones));
+    if (!tones) {
+        fprintf(stderr, "Failed to allocate tones.\n");
+        exit(1);
+    }
+    memcpy(tones, symbols[0].tone, (n + 1) * sizeof(*tones));
+    return tones;
+}
+
 __attribute__((noreturn))
 static void usage(int exitcode)
 {
@@ -67,20 +85,43 @@ static void usage(int exitcode)
             "\t[-n noise floor dBFS or multiplier]\n"
             "\t[-N noise on signal dBFS or multiplier]\n"
             "\t Noise level < 0 for attenuation in dBFS, otherwise amplitude multiplier, 0 is off.\n"
+            "\t[-D uniform|gauss] noise distribution, gaussian noise is AWGN of equal RMS\n"
+            "\t[-e SNR dB] set the noise floor as SNR relative to the signal gain\n"
+            "\t[-E Es/N0 dB,symbol rate] set the noise floor as Es/N0 relative to the signal gain\n"
             "\t[-g signal gain dBFS or multiplier]\n"
             "\t Gain level < 0 for attenuation in dBFS, otherwise amplitude multiplier, 0 is 0 dBFS.\n"
             "\t Levels as dbFS or multiplier are peak values, e.g. 0 dB or 1.0 x are equivalent to -3 dB RMS.\n"
-            "\t[-W filter ratio]\n"
-            "\t[-G step width in us]\n"
+            "\t[-O lut|interp|rotator] oscillator engine, interp and rotator give cleaner spectra\n"
+            "\t[-R auto|double|float|fixed] render precision, float is faster and good for up to 16 bit formats\n"
+            "\t Fixed is integer only, for CS8/CS16, auto uses fixed if possible, otherwise double.\n"
+            "\t[-W filter ratio[,butter|fir[,order]]] Butterworth of even order (default: 2) or linear-phase FIR of odd taps (default: 63)\n"
+            "\t[-G step width in us[,linear|cosine|gauss]] shape of the amplitude and frequency steps (default: linear)\n"
+            "\t[-H] hop the frequency between tones instead of ramping it over the step\n"
+            "\t[-K BT,symbol rate] GFSK, a gaussian frequency pulse, e.g. -K 0.5,10k\n"
             "\t[-b output_block_size (default: 16 * 16384) bytes]\n"
+            "\t[-B buffers] output blocks queued to a writer thread (default: 4), 1 writes directly\n"
+            "\t[-j threads] render on threads if the output is a file, the output is the same\n"
+            "\t[-o write|mmap] output method, mmap renders into a mapping of the output file\n"
+            "\t[-c entries] cache oscillator blocks of repeated tones, e.g. 256, replayed with a phase rotation\n"
+            "\t Needs -O rotator, integer formats then differ by at most 1 LSB from a render without cache.\n"
+            "\t[-I factor|auto] render at sample_rate / factor and interpolate, auto pick from the tones and the filter\n"
+            "\t The tones and the filter cutoff need to stay below 0.3 of the render rate, a larger factor is reduced.\n"
+            "\t[-C file[,seconds]] checkpoint a single output to file (default: every 10 s), a rerun resumes from it\n"
+            "\t[-J file] write render stats per stage as JSON to file ('-' writes to stdout)\n"
             "\t[-r file] read code from file ('-' reads from stdin)\n"
             "\t[-t code_text] parse given code text\n"
             "\t[-S rand_seed] set random seed for reproducible output\n"
             "\t[-M full_scale] limit the output full scale, e.g. use -F 2048 with CS16\n"
-            "\t[-w file] write samples to file ('-' writes to stdout)\n\n");
+            "\t[-w file] write samples to file ('-' writes to stdout)\n"
+            "\t Use -w up to %d times to render all outputs in one pass, each -w takes the options before it.\n"
+            "\t[-x offset Hz[,start us[,level dB]]] mix the next -r or -t input as an emitter into one wideband output\n"
+            "\t Use -x up to %d times, idle emitters cost nothing.\n\n",
+            MAX_OUTPUTS, MAX_EMITTERS);
     exit(exitcode);
 }
 
+static int abort_render;
+
 #ifdef _WIN32
 BOOL WINAPI
 sighandler(int signum)
@@ -106,18 +147,26 @@ int main(int argc, char **argv)
 
     double base_f[16] = {10000.0, -10000.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
     double *next_f = base_f;
-    char *wr_filename = NULL;
+    char *wr_filename[MAX_OUTPUTS];
+    iq_render_t wr_spec[MAX_OUTPUTS];
+    size_t outputs = 0;
 
     iq_render_t spec = {0};
     iq_render_defaults(&spec);
+    spec.flag_abort = &abort_render;
+    iq_render_stats_t stats = {0};
+    char const *stats_path  = NULL;
 
     symbol_t *symbols = NULL;
-    unsigned rand_seed = 1;
+
+    iq_emitter_t mix[MAX_EMITTERS];
+    size_t emitters = 0;
+    int mix_next    = 0; // the next input is an emitter
 
     print_version();
 
     int opt;
-    while ((opt = getopt(argc, argv, "hVvs:f:n:N:g:W:G:b:r:w:t:M:S:")) != -1) {
+    while ((opt = getopt(argc, argv, "hVvs:f:n:N:g:W:G:b:r:w:t:M:S:D:e:E:O:j:R:o:B:c:I:C:J:HK:x:")) != -1) {
         switch (opt) {
         case 'h':
             usage(0);
@@ -138,32 +187,167 @@ int main(int argc, char **argv)
         case 'N':
             spec.noise_signal = atod_metric(optarg, "-N: ");
             break;
+        case 'D':
+            if (*optarg == 'U' || *optarg == 'u')
+                spec.noise_mode = NOISE_UNIFORM;
+            else if (*optarg == 'G' || *optarg == 'g')
+                spec.noise_mode = NOISE_GAUSSIAN;
+            else
+                usage(1);
+            break;
+        case 'e':
+            spec.noise_ref   = NOISE_REF_SNR;
+            spec.noise_floor = atod_metric(optarg, "-e: ");
+            break;
+        case 'E':
+            spec.noise_ref   = NOISE_REF_ESN0;
+            spec.noise_floor = atod_metric(asepc(&optarg, ','), "-E: ");
+            if (!optarg)
+                usage(1);
+            spec.symbol_rate = atodu_metric(optarg, "-E: ");
+            break;
         case 'g':
             spec.gain = atod_metric(optarg, "-g: ");
             break;
+        case 'O':
+            if (*optarg == 'L' || *optarg == 'l')
+                spec.nco_engine = NCO_LUT;
+            else if (*optarg == 'I' || *optarg == 'i')
+                spec.nco_engine = NCO_LUT_INTERP;
+            else if (*optarg == 'R' || *optarg == 'r')
+                spec.nco_engine = NCO_ROTATOR;
+            else
+                usage(1);
+            break;
         case 'W':
-            spec.filter_wc = atodu_metric(optarg, "-W: ");
+            spec.filter_wc = atodu_metric(asepc(&optarg, ','), "-W: ");
+            if (optarg) {
+                char *type = asepc(&optarg, ',');
+                if (*type == 'B' || *type == 'b')
+                    spec.filter_type = FILTER_BUTTERWORTH;
+                else if (*type == 'F' || *type == 'f')
+                    spec.filter_type = FILTER_FIR;
+                else
+                    usage(1);
+            }
+            if (optarg)
+                spec.filter_order = atou_metric(optarg, "-W: ");
             break;
         case 'G':
-            spec.step_width = atou_metric(optarg, "-G: ");
+            spec.step_width = atou_metric(asepc(&optarg, ','), "-G: ");
+            if (!optarg)
+                spec.step_shape = STEP_LINEAR;
+            else if (*optarg == 'L' || *optarg == 'l')
+                spec.step_shape = STEP_LINEAR;
+            else if (*optarg == 'C' || *optarg == 'c')
+                spec.step_shape = STEP_COSINE;
+            else if (*optarg == 'G' || *optarg == 'g')
+                spec.step_shape = STEP_GAUSSIAN;
+            else
+                usage(1);
+            break;
+        case 'H':
+            spec.freq_step = 0;
+            break;
+        case 'x':
+            if (emitters == MAX_EMITTERS) {
+                fprintf(stderr, "Too many emitters, at most %d.\n", MAX_EMITTERS);
+                usage(1);
+            }
+            mix[emitters].hz       = atoi_metric(asepc(&optarg, ','), "-x: ");
+            mix[emitters].start_us = 0;
+            mix[emitters].level    = 0.0;
+            if (optarg)
+                mix[emitters].start_us = atou_metric(asepc(&optarg, ','), "-x: ");
+            if (optarg)
+                mix[emitters].level = atod_metric(optarg, "-x: ");
+            mix_next = 1;
+            break;
+        case 'K':
+            spec.gauss_bt = atodu_metric(asepc(&optarg, ','), "-K: ");
+            if (optarg)
+                spec.symbol_rate = atodu_metric(optarg, "-K: ");
+            else
+                usage(1);
+            break;
+        case 'R':
+            if (*optarg == 'D' || *optarg == 'd')
+                spec.precision = PRECISION_DOUBLE;
+            else if (!strcmp(optarg, "f") || !strcmp(optarg, "F") || !strcmp(optarg, "float"))
+                spec.precision = PRECISION_FLOAT;
+            else if (!strcmp(optarg, "fixed"))
+                spec.precision = PRECISION_FIXED;
+            else if (*optarg == 'A' || *optarg == 'a')
+                spec.precision = PRECISION_AUTO;
+            else
+                usage(1);
+            break;
+        case 'o':
+            if (*optarg == 'W' || *optarg == 'w')
+                spec.output_mode = OUTPUT_WRITE;
+            else if (*optarg == 'M' || *optarg == 'm')
+                spec.output_mode = OUTPUT_MMAP;
+            else
+                usage(1);
+            break;
+        case 'j':
+            spec.threads = atou_metric(optarg, "-j: ");
+            break;
+        case 'c':
+            spec.wave_cache = atou_metric(optarg, "-c: ");
+            break;
+        case 'I':
+            if (*optarg == 'A' || *optarg == 'a')
+                spec.interp = INTERP_AUTO;
+            else
+                spec.interp = (int)atou_metric(optarg, "-I: ");
+            break;
+        case 'J':
+            stats_path = optarg;
+            break;
+        case 'C':
+            spec.checkpoint = asepc(&optarg, ',');
+            if (optarg)
+                spec.checkpoint_s = atou_metric(optarg, "-C: ");
             break;
         case 'b':
             spec.frame_size = atou_metric(optarg, "-b: ");
             break;
+        case 'B':
+            spec.write_buffers = atou_metric(optarg, "-B: ");
+            break;
         case 'r':
+            if (mix_next && symbols)
+                memset(symbols[0].tone, 0, sizeof(symbols[0].tone));
             symbols = parse_code_file(optarg, symbols);
+            if (mix_next) {
+                mix[emitters++].tones = take_tones(symbols);
+                mix_next = 0;
+            }
             break;
         case 'w':
-            wr_filename = optarg;
+            if (outputs == MAX_OUTPUTS) {
+                fprintf(stderr, "Too many outputs, at most %d.\n", MAX_OUTPUTS);
+                usage(1);
+            }
+            wr_filename[outputs] = optarg;
+            wr_spec[outputs]     = spec;
+            outputs++;
             break;
         case 't':
+            if (mix_next && symbols)
+                memset(symbols[0].tone, 0, sizeof(symbols[0].tone));
             symbols = parse_code(optarg, symbols);
+            if (mix_next) {
+                mix[emitters++].tones = take_tones(symbols);
+                mix_next = 0;
+            }
             break;
         case 'M':
             spec.full_scale = atof(optarg);
             break;
         case 'S':
-            rand_seed = (unsigned)atoi(optarg);
+            spec.rand_seed = (unsigned)atoi(optarg);
             break;
         default:
             usage(1);
@@ -175,26 +359,38 @@ int main(int argc, char **argv)
         usage(1);
     }
 
-    if (!symbols) {
+    if (!symbols && !emitters) {
         fprintf(stderr, "Input from stdin.\n");
         symbols = parse_code(read_text_fd(fileno(stdin), "STDIN"), symbols);
     }
 
-    if (!wr_filename) {
+    if (!outputs) {
         fprintf(stderr, "Output to stdout.\n");
-        wr_filename = "-";
+        wr_filename[0] = "-";
+        outputs = 1;
     }
+    // options after the last -w apply to the last output
+    wr_spec[outputs - 1] = spec;
+    // the stats sum up all outputs
+    for (size_t k = 0; k < outputs; ++k)
+        wr_spec[k].stats = stats_path ? &stats : NULL;
 
-    spec.sample_format = file_info(&wr_filename);
-    if (verbosity)
-        fprintf(stderr, "Output format %s.\n", sample_format_str(spec.sample_format));
+    for (size_t k = 0; k < outputs; ++k) {
+        wr_spec[k].sample_format = file_info(&wr_filename[k]);
+        if (wr_spec[k].wave_cache && wr_spec[k].nco_engine != NCO_ROTATOR) {
+            fprintf(stderr, "The oscillator cache (-c) needs the rotator oscillator (-O rotator), not caching.\n");
+            wr_spec[k].wave_cache = 0;
+        }
+        if (verbosity)
+            fprintf(stderr, "Output format %s.\n", sample_format_str(wr_spec[k].sample_format));
 
-    if (spec.frame_size < MINIMAL_BUF_LENGTH ||
-            spec.frame_size > MAXIMAL_BUF_LENGTH) {
-        fprintf(stderr, "Output block size wrong value, falling back to default\n");
-        fprintf(stderr, "Minimal length: %d\n", MINIMAL_BUF_LENGTH);
-        fprintf(stderr, "Maximal length: %d\n", MAXIMAL_BUF_LENGTH);
-        spec.frame_size = DEFAULT_BUF_LENGTH;
+        if (wr_spec[k].frame_size < MINIMAL_BUF_LENGTH ||
+                wr_spec[k].frame_size > MAXIMAL_BUF_LENGTH) {
+            fprintf(stderr, "Output block size wrong value, falling back to default\n");
+            fprintf(stderr, "Minimal length: %d\n", MINIMAL_BUF_LENGTH);
+            fprintf(stderr, "Maximal length: %d\n", MAXIMAL_BUF_LENGTH);
+            wr_spec[k].frame_size = DEFAULT_BUF_LENGTH;
+        }
     }
 
 #ifndef _WIN32
@@ -210,7 +406,18 @@ int main(int argc, char **argv)
     SetConsoleCtrlHandler((PHANDLER_ROUTINE)sighandler, TRUE);
 #endif
 
-    srand(rand_seed);
+    int failed = 0;
+    if (emitters) {
+        for (size_t k = 0; k < outputs; ++k)
+            if (iq_render_mix(wr_filename[k], &wr_spec[k], mix, emitters))
+                failed = 1;
+        if (stats_path)
+            iq_render_stats_json(stats_path, &stats);
+        for (size_t k = 0; k < emitters; ++k)
+            free(mix[k].tones);
+        free_symbols(symbols);
+        return failed;
+    }
 
     if (verbosity > 1)
         output_symbol(symbols);
@@ -221,7 +428,12 @@ int main(int argc, char **argv)
         fprintf(stderr, "Signal length: %zu us, %zu smp\n\n", length_us, length_smp);
     }
 
-    iq_render_file(wr_filename, &spec, symbols->tone);
+    if (iq_render_files(wr_filename, wr_spec, outputs, symbols->tone))
+        failed = 1;
+    if (stats_path)
+        iq_render_stats_json(stats_path, &stats);
 
     free_symbols(symbols);
+
+    return failed;
 }
@@ -114,7 +114,7 @@ static void parse_tone(char const **buf, tone_t *tone, symbol_t *symbols)
         skip_ws(&p);
     }
     if (tone->db == -200)
-        tone->db = -99;
+        tone->db = -100; // silence
     if (p && *p == ')')
         ++p;
 
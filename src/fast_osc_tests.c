@@ -110,6 +110,98 @@ static void nco_add_sine(double *buf, ssize_t freq_hz, size_t sample_rate, size_
 #define SAMPLE_COUNT 100000
 #define LOOPS 100
 
+static void engine_add_sine(nco_block_fn osc, double *buf, ssize_t freq_hz, size_t sample_rate, size_t time_us, double att_db)
+{
+    double c[1024], s[1024];
+    uint32_t d_phi = nco_d_phase(freq_hz, sample_rate);
+    uint32_t phi = 0;
+    size_t end = (size_t)(time_us * sample_rate / 1000000);
+    for (size_t t = 0; t < end; t += 1024) {
+        size_t len = end - t < 1024 ? end - t : 1024;
+        phi = osc(phi, d_phi, len, c, s);
+        for (size_t k = 0; k < len; ++k) {
+            *buf++ = c[k] * att_db;
+            *buf++ = s[k] * att_db;
+        }
+    }
+}
+
+// spurious-free dynamic range
+
+#define SFDR_SIZE 65536 ///< DFT length, phases of odd multiples of 2^16 repeat exactly
+
+/// In-place radix-2 complex FFT of interleaved I/Q.
+static void fft(double *x, size_t n)
+{
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double tr = x[2 * i], ti = x[2 * i + 1];
+            x[2 * i] = x[2 * j], x[2 * i + 1] = x[2 * j + 1];
+            x[2 * j] = tr, x[2 * j + 1] = ti;
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double a = -2.0 * M_PI / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < len / 2; ++k) {
+                double wr = cos(a * k), wi = sin(a * k);
+                double *u = &x[2 * (i + k)];
+                double *v = &x[2 * (i + k + len / 2)];
+                double vr = v[0] * wr - v[1] * wi;
+                double vi = v[0] * wi + v[1] * wr;
+                v[0] = u[0] - vr, v[1] = u[1] - vi;
+                u[0] += vr, u[1] += vi;
+            }
+        }
+    }
+}
+
+/// Throughput of an engine in Msps, without any output conversion.
+static double engine_rate(nco_block_fn osc, size_t samples)
+{
+    static double c[1024], s[1024];
+    uint32_t d_phi = nco_d_phase(12345, SAMPLE_RATE);
+    uint32_t phi = 0;
+    double sum = 0;
+    clock_t start = clock();
+    for (size_t t = 0; t < samples; t += 1024) {
+        phi = osc(phi, d_phi, 1024, c, s);
+        sum += c[t % 1024]; // keep the result alive
+    }
+    clock_t stop = clock();
+    double elapsed = (double)(stop - start) / CLOCKS_PER_SEC;
+    return sum != sum ? 0 : samples / elapsed / 1e6;
+}
+
+/// SFDR in dB of an engine, coherent sampling at an odd bin, i.e. no window needed.
+static double engine_sfdr(nco_block_fn osc, size_t bin)
+{
+    static double c[SFDR_SIZE], s[SFDR_SIZE], x[2 * SFDR_SIZE];
+    uint32_t d_phi = (uint32_t)(bin * (4294967296.0 / SFDR_SIZE));
+    uint32_t phi = 0;
+    for (size_t t = 0; t < SFDR_SIZE; t += 1024)
+        phi = osc(phi, d_phi, 1024, &c[t], &s[t]);
+    for (size_t t = 0; t < SFDR_SIZE; ++t) {
+        x[2 * t]     = c[t];
+        x[2 * t + 1] = s[t];
+    }
+    fft(x, SFDR_SIZE);
+
+    double carrier = 0, spur = 1e-300; // floor at about -3000 dB
+    for (size_t k = 0; k < SFDR_SIZE; ++k) {
+        double p = x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1];
+        if (k == bin)
+            carrier = p;
+        else if (p > spur)
+            spur = p;
+    }
+    return 10.0 * log10(carrier / spur);
+}
+
 static void print_summary(char const *label, clock_t start, clock_t stop, double *buf, size_t len)
 {
     double elapsed = (double)(stop - start) * 1000.0 / CLOCKS_PER_SEC;
@@ -179,5 +271,32 @@ int main(int argc, char **argv)
     stop = clock();
     print_summary("NCO   ", start, stop, out_block, samples);
 
+    // NCO engines
+
+    struct {
+        char const *label;
+        nco_block_fn osc;
+    } engines[] = {
+            {"LUT   ", nco_block_lut},
+            {"Interp", nco_block_interp},
+            {"Rotate", nco_block_rotator},
+    };
+    for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); ++e) {
+        start = clock();
+
+        for (size_t i = 0; i < LOOPS; ++i) {
+            engine_add_sine(engines[e].osc, out_block, 10000, (size_t)sample_rate, samples, 1.0);
+            engine_add_sine(engines[e].osc, out_block, 20000, (size_t)sample_rate, samples, 1.0);
+            engine_add_sine(engines[e].osc, out_block, 30000, (size_t)sample_rate, samples, 1.0);
+        }
+
+        stop = clock();
+        print_summary(engines[e].label, start, stop, out_block, samples);
+
+        printf("%s: %.1f Msps, SFDR %.1f dB (bin 1001), %.1f dB (bin 12345)\n", engines[e].label,
+                engine_rate(engines[e].osc, 3 * LOOPS * samples),
+                engine_sfdr(engines[e].osc, 1001), engine_sfdr(engines[e].osc, 12345));
+    }
+
     free(out_block);
 }
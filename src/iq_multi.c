@@ -0,0 +1,474 @@
+/** @file
+    tx_tools - iq_multi, render to several outputs in one pass, and mix emitters to one output.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "iq_render_ctx.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+
+// fan-out
+
+/// Copy the shared oscillator output, and the noise if used, to an output context.
+static void fanout_copy(ctx_t *dst, ctx_t const *src, size_t len)
+{
+    if (dst->precision == PRECISION_FIXED) {
+        memcpy(dst->qbuf_i, src->qbuf_i, len * sizeof(*dst->qbuf_i));
+        memcpy(dst->qbuf_q, src->qbuf_q, len * sizeof(*dst->qbuf_q));
+        if (dst->noise_on) {
+            memcpy(dst->qnoise_si, src->qnoise_si, len * sizeof(*dst->qnoise_si));
+            memcpy(dst->qnoise_sq, src->qnoise_sq, len * sizeof(*dst->qnoise_sq));
+            memcpy(dst->qnoise_fi, src->qnoise_fi, len * sizeof(*dst->qnoise_fi));
+            memcpy(dst->qnoise_fq, src->qnoise_fq, len * sizeof(*dst->qnoise_fq));
+        }
+    }
+    else if (dst->precision == PRECISION_FLOAT) {
+        memcpy(dst->fbuf_i, src->fbuf_i, len * sizeof(*dst->fbuf_i));
+        memcpy(dst->fbuf_q, src->fbuf_q, len * sizeof(*dst->fbuf_q));
+        if (dst->noise_on) {
+            memcpy(dst->fnoise_si, src->fnoise_si, len * sizeof(*dst->fnoise_si));
+            memcpy(dst->fnoise_sq, src->fnoise_sq, len * sizeof(*dst->fnoise_sq));
+            memcpy(dst->fnoise_fi, src->fnoise_fi, len * sizeof(*dst->fnoise_fi));
+            memcpy(dst->fnoise_fq, src->fnoise_fq, len * sizeof(*dst->fnoise_fq));
+        }
+    }
+    else {
+        memcpy(dst->buf_i, src->buf_i, len * sizeof(*dst->buf_i));
+        memcpy(dst->buf_q, src->buf_q, len * sizeof(*dst->buf_q));
+        if (dst->noise_on) {
+            memcpy(dst->noise_si, src->noise_si, len * sizeof(*dst->noise_si));
+            memcpy(dst->noise_sq, src->noise_sq, len * sizeof(*dst->noise_sq));
+            memcpy(dst->noise_fi, src->noise_fi, len * sizeof(*dst->noise_fi));
+            memcpy(dst->noise_fq, src->noise_fq, len * sizeof(*dst->noise_fq));
+        }
+    }
+}
+
+/// Open an output for a direct write, a regular file gets holes for zero codes.
+static void output_open(ctx_t *out, char const *outpath)
+{
+    if (!outpath || !*outpath || !strcmp(outpath, "-"))
+        out->fd = fileno(stdout);
+    else
+        out->fd = open(outpath, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (out->fd < 0) {
+        fprintf(stderr, "Failed to open output \"%s\" (%s).\n", outpath, strerror(errno));
+        exit(1);
+    }
+#ifndef _WIN32
+    struct stat st;
+    int regular = fstat(out->fd, &st) == 0 && S_ISREG(st.st_mode);
+    out->sparse = regular && !(fcntl(out->fd, F_GETFL) & O_APPEND) && zero_block_is_zero(out);
+#endif
+
+    out->frame.u8 = malloc(out->frame_size);
+    if (!out->frame.u8) {
+        fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", out->frame_size);
+        exit(1);
+    }
+}
+
+/// Flush and close an output opened with output_open().
+static void output_close(ctx_t *out)
+{
+    signal_out_flush(out);
+#ifndef _WIN32
+    // a hole at the end needs the file extended
+    struct stat st;
+    off_t end = lseek(out->fd, 0, SEEK_CUR);
+    if (out->sparse && end >= 0 && fstat(out->fd, &st) == 0 && st.st_size < end && ftruncate(out->fd, end)) {
+        fprintf(stderr, "Failed to extend the output file.\n");
+        out->out_failed = 1;
+    }
+#endif
+    free(out->frame.u8);
+    if (out->fd != fileno(stdout))
+        close(out->fd);
+}
+
+/// Render the plan of the lead context to all outputs in one pass.
+/// The oscillator and the unit noise are rendered once per block and precision,
+/// the outputs only ramp, disturb and pack, the same as a render of each alone.
+static void iq_render_fanout(ctx_t *lead, ctx_t **outs, int *silent, size_t count)
+{
+    for (size_t k = 0; k < lead->plan_len && !render_aborted(lead); ++k) {
+        plan_begin(lead, k);
+        for (size_t v = 0; v < count; ++v)
+            plan_begin(outs[v], k);
+
+        for (size_t t = 0; t < lead->tone_len; t += RENDER_CHUNK) {
+            size_t len = lead->tone_len - t < RENDER_CHUNK ? lead->tone_len - t : RENDER_CHUNK;
+
+            // the shared stages needed, by precision
+            int osc[3]   = {0};
+            int noise[3] = {0};
+            for (size_t v = 0; v < count; ++v) {
+                silent[v] = tone_silent(outs[v], t);
+                if (!silent[v]) {
+                    osc[outs[v]->precision] = 1;
+                    noise[outs[v]->precision] |= outs[v]->noise_on;
+                }
+            }
+
+            if (lead->stats_on)
+                lead->stats_lap = stats_now();
+            uint32_t phi = lead->phi;
+            if (osc[PRECISION_DOUBLE])
+                lead->phi = phi, osc_block(lead, t, len);
+            stats_lap(lead, &lead->stats.osc_s);
+            if (noise[PRECISION_DOUBLE])
+                render_noise(lead, len);
+            stats_lap(lead, &lead->stats.noise_s);
+            if (osc[PRECISION_FLOAT])
+                lead->phi = phi, osc_blockf(lead, t, len);
+            stats_lap(lead, &lead->stats.osc_s);
+            if (noise[PRECISION_FLOAT])
+                render_noisef(lead, len);
+            stats_lap(lead, &lead->stats.noise_s);
+            if (osc[PRECISION_FIXED])
+                lead->phi = phi, osc_blockq(lead, t, len);
+            stats_lap(lead, &lead->stats.osc_s);
+            if (noise[PRECISION_FIXED])
+                render_noiseq(lead, len);
+            stats_lap(lead, &lead->stats.noise_s);
+            lead->phi = phi + tone_advance(lead, t, len);
+            lead->smp_pos += len;
+
+            for (size_t v = 0; v < count; ++v) {
+                ctx_t *out = outs[v];
+                if (out->stats_on)
+                    out->stats_lap = stats_now();
+                if (silent[v]) {
+                    render_zero(out, len);
+                }
+                else {
+                    fanout_copy(out, lead, len);
+                    out->phi += tone_advance(out, t, len);
+                    if (out->precision == PRECISION_FIXED) {
+                        render_rampq(out, t, len, out->g_att, out->n_att);
+                        stats_lap(out, &out->stats.osc_s);
+                        out->disturb(out, len);
+                        stats_lap(out, &out->stats.filter_s);
+                        render_packq(out, len);
+                    }
+                    else if (out->precision == PRECISION_FLOAT) {
+                        render_rampf(out, t, len, out->g_att, out->n_att);
+                        stats_lap(out, &out->stats.osc_s);
+                        out->disturb(out, len);
+                        stats_lap(out, &out->stats.filter_s);
+                        render_packf(out, len);
+                    }
+                    else {
+                        render_ramp(out, t, len, out->g_att, out->n_att);
+                        stats_lap(out, &out->stats.osc_s);
+                        out->disturb(out, len);
+                        stats_lap(out, &out->stats.filter_s);
+                        render_pack(out, len);
+                    }
+                }
+                stats_lap(out, &out->stats.pack_s);
+                out->smp_pos += len;
+                lead->out_failed |= out->out_failed; // stops all outputs
+            }
+        }
+    }
+}
+
+/// Check if the outputs can share the oscillator and the noise.
+static int fanout_compatible(iq_render_t const *specs, size_t count)
+{
+    for (size_t v = 1; v < count; ++v) {
+        if (specs[v].sample_rate != specs[0].sample_rate
+                || specs[v].step_width != specs[0].step_width
+                || specs[v].step_shape != specs[0].step_shape
+                || specs[v].freq_step != specs[0].freq_step
+                || specs[v].gauss_bt != specs[0].gauss_bt
+                || (specs[0].gauss_bt > 0.0 && specs[v].symbol_rate != specs[0].symbol_rate)
+                || specs[v].nco_engine != specs[0].nco_engine
+                || specs[v].noise_mode != specs[0].noise_mode
+                || specs[v].rand_seed != specs[0].rand_seed)
+            return 0;
+    }
+    for (size_t v = 0; v < count; ++v)
+        if (specs[v].interp)
+            return 0;
+    return 1;
+}
+
+int iq_render_files(char **outpaths, iq_render_t *specs, size_t count, tone_t *tones)
+{
+    if (count == 1)
+        return iq_render_file(outpaths[0], &specs[0], tones);
+
+    for (size_t v = 0; v < count; ++v)
+        if (specs[v].sample_rate == 0.0)
+            specs[v].sample_rate = DEFAULT_SAMPLE_RATE;
+    if (!fanout_compatible(specs, count)) {
+        fprintf(stderr, "Outputs differ in sample rate, step width, oscillator, noise mode or seed, or interpolate, rendering each alone.\n");
+        int r = 0;
+        for (size_t v = 0; v < count; ++v)
+            if (iq_render_file(outpaths[v], &specs[v], tones))
+                r = -1;
+        return r;
+    }
+
+    ctx_t *lead  = calloc(1, sizeof(*lead));
+    ctx_t **outs = calloc(count, sizeof(*outs));
+    int *silent  = calloc(count, sizeof(*silent));
+    if (!lead || !outs || !silent) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        exit(1);
+    }
+    lead->fd = -1;
+    iq_render_init(lead, &specs[0], 1);
+    render_plan(lead, tones);
+
+    for (size_t v = 0; v < count; ++v) {
+        ctx_t *out = calloc(1, sizeof(*out));
+        if (!out) {
+            fprintf(stderr, "Failed to allocate render context.\n");
+            exit(1);
+        }
+        outs[v] = out;
+        iq_render_init(out, &specs[v], 1);
+        out->stats_on = lead->stats_on; // summed to the lead
+        out->plan     = lead->plan;
+        out->plan_len = lead->plan_len;
+        output_open(out, outpaths[v]);
+    }
+
+    stats_begin(lead);
+
+    iq_render_fanout(lead, outs, silent, count);
+    size_t signal_length_us = iq_render_length_us(tones);
+
+    for (size_t v = 0; v < count; ++v)
+        stats_add(&lead->stats, &outs[v]->stats);
+    double elapsed = stats_end(lead);
+    if (!specs[0].quiet)
+        printf("Time elapsed %g ms, signal length %g ms, %zu outputs, speed %gx\n", elapsed, signal_length_us / 1000.0, count, signal_length_us / 1000.0 / elapsed);
+
+    int r = lead->out_failed ? -1 : 0;
+    for (size_t v = 0; v < count; ++v) {
+        output_close(outs[v]);
+        if (outs[v]->out_failed)
+            r = -1;
+        render_free(outs[v]);
+        free(outs[v]);
+    }
+    free(lead->plan);
+    render_free(lead);
+    free(lead);
+    free(outs);
+    free(silent);
+
+    return r;
+}
+
+// multi-carrier mix
+
+/// An emitter of a mix, rendered from its plan while active.
+typedef struct mix_emitter {
+    ctx_t *ctx;
+    tone_t *tones; ///< the tones with the frequency offset
+    size_t start;  ///< first sample on the timeline
+    size_t end;    ///< the sample after the last
+    size_t tone;   ///< current tone of the plan
+    size_t t;      ///< samples into the current tone
+} mix_emitter_t;
+
+static int mix_emitter_cmp(void const *a, void const *b)
+{
+    size_t sa = ((mix_emitter_t const *)a)->start;
+    size_t sb = ((mix_emitter_t const *)b)->start;
+    return sa < sb ? -1 : sa > sb;
+}
+
+/// Add the next len samples of an emitter to the mix, silent stretches only advance the phase.
+/// Returns 1 if any samples were rendered.
+static int mix_emitter_add(mix_emitter_t *em, double *mix_i, double *mix_q, size_t len)
+{
+    ctx_t *ctx  = em->ctx;
+    int audible = 0;
+    while (len && em->tone < ctx->plan_len) {
+        size_t n = ctx->tone_len - em->t < len ? ctx->tone_len - em->t : len;
+        if (ctx->n_att == 0.0 && (ctx->g_att == 0.0 || em->t >= ctx->step_len)) {
+            ctx->phi += tone_advance(ctx, em->t, n);
+        }
+        else {
+            render_wave(ctx, em->t, n);
+            for (size_t t = 0; t < n; ++t) {
+                mix_i[t] += ctx->buf_i[t];
+                mix_q[t] += ctx->buf_q[t];
+            }
+            audible = 1;
+        }
+        em->t += n;
+        mix_i += n;
+        mix_q += n;
+        len -= n;
+        if (em->t == ctx->tone_len && ++em->tone < ctx->plan_len) {
+            plan_begin(ctx, em->tone);
+            em->t = 0;
+        }
+    }
+    return audible;
+}
+
+/// Render the emitters on the timeline, the emitters are sorted by start.
+/// Only the active emitters are visited, the silent blocks of the mix are zero codes.
+static void iq_render_mix_loop(ctx_t *out, mix_emitter_t *ems, mix_emitter_t **active, size_t count, size_t total)
+{
+    size_t next    = 0; // next emitter to start
+    size_t actives = 0;
+    for (size_t pos = 0; pos < total && !render_aborted(out); pos += RENDER_CHUNK) {
+        size_t len = total - pos < RENDER_CHUNK ? total - pos : RENDER_CHUNK;
+
+        while (next < count && ems[next].start < pos + len) {
+            mix_emitter_t *em = &ems[next++];
+            if (em->end > em->start) {
+                plan_begin(em->ctx, 0);
+                active[actives++] = em;
+            }
+        }
+
+        if (out->stats_on)
+            out->stats_lap = stats_now();
+        memset(out->buf_i, 0, len * sizeof(*out->buf_i));
+        memset(out->buf_q, 0, len * sizeof(*out->buf_q));
+        int audible = 0;
+        for (size_t k = 0; k < actives;) {
+            mix_emitter_t *em = active[k];
+            size_t off = em->start > pos ? em->start - pos : 0;
+            size_t end = em->end < pos + len ? em->end - pos : len;
+            audible |= mix_emitter_add(em, out->buf_i + off, out->buf_q + off, end - off);
+            if (em->end <= pos + len)
+                active[k] = active[--actives]; // done
+            else
+                ++k;
+        }
+
+        stats_lap(out, &out->stats.osc_s);
+
+        if (!audible && !out->noise_on && filter_settled(out)) {
+            render_zero(out, len);
+        }
+        else {
+            if (out->noise_on)
+                render_noise(out, len);
+            stats_lap(out, &out->stats.noise_s);
+            out->disturb(out, len);
+            stats_lap(out, &out->stats.filter_s);
+            render_pack(out, len);
+        }
+        stats_lap(out, &out->stats.pack_s);
+        out->smp_pos += len;
+    }
+}
+
+int iq_render_mix(char *outpath, iq_render_t *spec, iq_emitter_t *emitters, size_t count)
+{
+    iq_render_t mix_spec = *spec;
+    mix_spec.precision   = PRECISION_DOUBLE;
+
+    ctx_t *out              = calloc(1, sizeof(*out));
+    mix_emitter_t *ems      = calloc(count ? count : 1, sizeof(*ems));
+    mix_emitter_t **active  = calloc(count ? count : 1, sizeof(*active));
+    if (!out || !ems || !active) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        exit(1);
+    }
+    out->fd = -1;
+    iq_render_init(out, &mix_spec, 1);
+
+    // the emitters alone, without noise and filter
+    iq_render_t em_spec  = mix_spec;
+    em_spec.noise_floor  = 0.0;
+    em_spec.noise_signal = 0.0;
+    em_spec.noise_ref    = NOISE_REF_FS;
+    em_spec.stats        = NULL; // timed as the oscillator stage of the mix
+    size_t total = 0;
+    for (size_t k = 0; k < count; ++k) {
+        mix_emitter_t *em = &ems[k];
+        size_t n = 0;
+        while (emitters[k].tones[n].us || emitters[k].tones[n].hz)
+            n++;
+        em->tones = malloc((n + 1) * sizeof(*em->tones));
+        em->ctx   = calloc(1, sizeof(*em->ctx));
+        if (!em->tones || !em->ctx) {
+            fprintf(stderr, "Failed to allocate render context.\n");
+            exit(1);
+        }
+        for (size_t j = 0; j < n; ++j) {
+            em->tones[j] = emitters[k].tones[j];
+            em->tones[j].hz += emitters[k].hz;
+        }
+        em->tones[n] = (tone_t){0};
+
+        em->ctx->fd = -1;
+        iq_render_init(em->ctx, &em_spec, 1);
+        em->ctx->gain *= pow(10.0, emitters[k].level / 20.0);
+        render_plan(em->ctx, em->tones);
+        em->start = (size_t)(emitters[k].start_us * out->sample_rate / 1000000.0);
+        em->end   = em->start + em->ctx->plan[em->ctx->plan_len].start;
+        if (em->end > total)
+            total = em->end;
+    }
+    qsort(ems, count, sizeof(*ems), mix_emitter_cmp);
+
+    output_open(out, outpath);
+
+    stats_begin(out);
+
+    iq_render_mix_loop(out, ems, active, count, total);
+    double signal_length_ms = total * 1000.0 / out->sample_rate;
+
+    double elapsed = stats_end(out);
+    if (!spec->quiet)
+        printf("Time elapsed %g ms, signal length %g ms, %zu emitters, speed %gx\n", elapsed, signal_length_ms, count, signal_length_ms / elapsed);
+
+    output_close(out);
+    int r = out->out_failed ? -1 : 0;
+    render_free(out);
+    free(out);
+    for (size_t k = 0; k < count; ++k) {
+        free(ems[k].ctx->plan);
+        render_free(ems[k].ctx);
+        free(ems[k].ctx);
+        free(ems[k].tones);
+    }
+    free(ems);
+    free(active);
+
+    return r;
+}
@@ -0,0 +1,517 @@
+/** @file
+    tx_tools - iq_output, the output back ends of iq_render: writer thread, file mapping and checkpoints.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "iq_render_ctx.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <time.h>
+
+#include "noise.h"
+
+
+#define MMAP_WINDOW (4 * 1024 * 1024) ///< bytes rendered into the mapping between msync() calls
+
+// output
+
+/// Frames queued in order to a writer thread.
+typedef struct writer {
+    int fd;
+    size_t count;   ///< number of frame buffers
+    uint8_t **buf;
+    size_t *len;    ///< bytes in each queued frame
+    size_t *hole;   ///< bytes to skip before each queued frame
+    size_t head;    ///< oldest queued frame
+    size_t queued;  ///< frames waiting for the writer
+    size_t fill;    ///< frame being rendered
+    int done;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} writer_t;
+
+/// Write all of buf, retrying on short writes and interrupts, returns -1 on error.
+static int write_all(int fd, uint8_t const *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+/// Write all of buf at offset off, retrying on short writes and interrupts, returns -1 on error.
+static int pwrite_all(int fd, uint8_t const *buf, size_t len, off_t off)
+{
+    while (len) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+#endif
+
+/// Report a failed output write once, the render stops at the next block.
+static void signal_out_failed(ctx_t *ctx)
+{
+    if (!ctx->out_failed)
+        fprintf(stderr, "Failed to write output (%s).\n", strerror(errno));
+    ctx->out_failed = 1;
+}
+
+static void *writer_thread(void *arg)
+{
+    writer_t *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->queued && !w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->queued)
+            break;
+        size_t k = w->head;
+        pthread_mutex_unlock(&w->lock);
+
+        // keep taking frames after a failure, the renderer must not block
+        int failed = w->failed
+                || (w->hole[k] && lseek(w->fd, (off_t)w->hole[k], SEEK_CUR) < 0)
+                || write_all(w->fd, w->buf[k], w->len[k]);
+        if (failed && !w->failed)
+            fprintf(stderr, "Failed to write output (%s).\n", strerror(errno));
+
+        pthread_mutex_lock(&w->lock);
+        w->failed = failed;
+        w->head = (w->head + 1) % w->count;
+        w->queued -= 1;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/// Free the writer buffers, any of them may be missing.
+static void writer_free(writer_t *w)
+{
+    for (size_t k = 0; w->buf && k < w->count; ++k)
+        free(w->buf[k]);
+    free(w->buf);
+    free(w->len);
+    free(w->hole);
+    free(w);
+}
+
+/// Start a writer thread for the output, the frame is rendered in turns to the writer buffers.
+/// Returns -1 if the writer can't be started, the output is then written directly.
+int writer_open(ctx_t *ctx)
+{
+    writer_t *w = calloc(1, sizeof(*w));
+    if (!w)
+        return -1;
+    w->fd    = ctx->fd;
+    w->count = ctx->write_buffers;
+    w->buf   = calloc(w->count, sizeof(*w->buf));
+    w->len   = calloc(w->count, sizeof(*w->len));
+    w->hole  = calloc(w->count, sizeof(*w->hole));
+    int ok   = w->buf && w->len && w->hole;
+    for (size_t k = 0; ok && k < w->count; ++k) {
+        w->buf[k] = malloc(ctx->frame_size);
+        ok        = w->buf[k] != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate output buffers, writing directly.\n");
+        writer_free(w);
+        return -1;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, writer_thread, w)) {
+        fprintf(stderr, "Failed to start writer thread, writing directly.\n");
+        // no thread ever started, nothing to clean up but memory
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        writer_free(w);
+        return -1;
+    }
+
+    ctx->writer   = w;
+    ctx->frame.u8 = w->buf[0];
+    return 0;
+}
+
+/// Queue the frame and continue in the next free buffer.
+static void writer_push(ctx_t *ctx)
+{
+    writer_t *w = ctx->writer;
+
+    pthread_mutex_lock(&w->lock);
+    w->len[w->fill]  = ctx->frame_len;
+    w->hole[w->fill] = ctx->hole;
+    w->queued += 1;
+    w->fill = (w->fill + 1) % w->count;
+    pthread_cond_broadcast(&w->cond);
+    while (w->queued == w->count)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->failed)
+        ctx->out_failed = 1; // stops the render
+    pthread_mutex_unlock(&w->lock);
+
+    ctx->frame.u8  = w->buf[w->fill];
+    ctx->frame_len = 0;
+    ctx->hole      = 0;
+}
+
+/// Write out all queued frames and stop the writer thread, returns -1 if any write failed.
+int writer_close(ctx_t *ctx, uint8_t *frame)
+{
+    writer_t *w = ctx->writer;
+
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    int failed = w->failed;
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    writer_free(w);
+    ctx->writer   = NULL;
+    ctx->frame.u8 = frame;
+    return failed ? -1 : 0;
+}
+#ifndef _WIN32
+/// Move the frame window forward in the output mapping, the pages behind are synced asynchronously.
+void signal_out_advance(ctx_t *ctx)
+{
+    size_t pos  = (size_t)(ctx->frame.u8 - ctx->map) + ctx->frame_len + ctx->hole;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end  = pos / page * page;
+    if (end > ctx->map_synced) {
+        msync(ctx->map + ctx->map_synced, end - ctx->map_synced, MS_ASYNC);
+        ctx->map_synced = end;
+    }
+
+    size_t window   = MMAP_WINDOW / ctx->sample_size * ctx->sample_size;
+    ctx->frame.u8   = ctx->map + pos;
+    ctx->frame_len  = 0;
+    ctx->frame_size = ctx->map_len - pos < window ? ctx->map_len - pos : window;
+    ctx->hole       = 0;
+}
+#endif
+
+static inline void signal_out_write(ctx_t *ctx)
+{
+#ifndef _WIN32
+    if (ctx->map) {
+        signal_out_advance(ctx);
+        return;
+    }
+#endif
+    if (ctx->fd < 0)
+        return; // rendering to a buffer
+    if (ctx->writer) {
+        writer_push(ctx);
+        return;
+    }
+    if (ctx->out_failed) {
+        ctx->frame_len = 0; // the render is stopping
+        ctx->hole      = 0;
+        return;
+    }
+#ifndef _WIN32
+    if (ctx->hole) {
+        // skip over the zero codes, the file system keeps a hole
+        if (ctx->out_off >= 0)
+            ctx->out_off += (off_t)ctx->hole;
+        else if (lseek(ctx->fd, (off_t)ctx->hole, SEEK_CUR) < 0)
+            signal_out_failed(ctx);
+        ctx->hole = 0;
+    }
+    if (ctx->out_off >= 0) {
+        if (pwrite_all(ctx->fd, ctx->frame.u8, ctx->frame_len, ctx->out_off))
+            signal_out_failed(ctx);
+        ctx->out_off += (off_t)ctx->frame_len;
+        ctx->frame_len = 0;
+        return;
+    }
+#endif
+    if (!ctx->out_failed && write_all(ctx->fd, ctx->frame.u8, ctx->frame_len))
+        signal_out_failed(ctx);
+    ctx->frame_len = 0;
+}
+
+void signal_out_flush(ctx_t *ctx)
+{
+    double start = ctx->stats_on ? stats_now() : 0.0;
+    signal_out_write(ctx);
+    if (ctx->stats_on) {
+        double wait = stats_now() - start;
+        ctx->stats.write_s += wait;
+        ctx->stats_lap += wait; // not part of the stage that filled the frame
+    }
+}
+
+#ifndef _WIN32
+/// Size the output file and map it for rendering in place, returns -1 if the file can't be mapped.
+int signal_out_map(ctx_t *ctx, size_t len)
+{
+    struct stat st;
+    if (!len || fstat(ctx->fd, &st) || !S_ISREG(st.st_mode) || lseek(ctx->fd, 0, SEEK_CUR) != 0)
+        return -1;
+    if (ftruncate(ctx->fd, (off_t)len))
+        return -1;
+
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    ctx->map        = map;
+    ctx->map_len    = len;
+    ctx->map_synced = 0;
+    ctx->frame.u8   = map;
+    ctx->frame_len  = 0;
+    signal_out_advance(ctx);
+    return 0;
+}
+
+void signal_out_unmap(ctx_t *ctx)
+{
+    msync(ctx->map, ctx->map_len, MS_ASYNC);
+    munmap(ctx->map, ctx->map_len);
+    ctx->map = NULL;
+}
+#endif
+
+// checkpoints
+
+#define CHECKPOINT_MAGIC 0x50435854 // "TXCP"
+
+/// The render state at a block boundary, saved to the checkpoint file.
+/// The tone state and the phase are restored from the plan, the noise is keyed by the sample position.
+typedef struct checkpoint {
+    uint32_t magic;
+    uint32_t size;  ///< size of the checkpoint, to reject other builds
+    uint64_t key;   ///< hash of the spec and the tones
+    uint64_t tone;  ///< tone of the plan
+    uint64_t t;     ///< samples into the tone, after a whole block
+    uint64_t out_pos; ///< bytes of output written, with the holes
+    uint32_t phi;   ///< phase, checked against the plan
+    filter_state_t filter_state;
+} checkpoint_t;
+
+/// Hash of everything the output depends on.
+static uint64_t checkpoint_key(ctx_t const *ctx, iq_render_t const *spec, tone_t const *tones)
+{
+    double const dv[] = {spec->sample_rate, spec->noise_floor, spec->noise_signal, spec->gain, spec->filter_wc,
+            spec->gauss_bt, spec->full_scale, spec->symbol_rate};
+    int64_t const iv[] = {spec->filter_type, spec->filter_order, spec->step_width, spec->step_shape, spec->freq_step,
+            spec->sample_format, spec->rand_seed, spec->noise_mode, spec->noise_ref, spec->nco_engine, ctx->precision};
+
+    uint64_t key = CHECKPOINT_MAGIC;
+    uint64_t ctr = 0;
+    for (size_t k = 0; k < sizeof(dv) / sizeof(*dv); ++k) {
+        uint64_t bits;
+        memcpy(&bits, &dv[k], sizeof(bits));
+        key = noise_hash(key ^ bits, ctr++);
+    }
+    for (size_t k = 0; k < sizeof(iv) / sizeof(*iv); ++k)
+        key = noise_hash(key ^ (uint64_t)iv[k], ctr++);
+    for (tone_t const *tone = tones; tone->us || tone->hz; ++tone) {
+        key = noise_hash(key ^ (uint32_t)tone->hz ^ ((uint64_t)(uint32_t)tone->db << 32), ctr++);
+        key = noise_hash(key ^ (uint32_t)tone->ph ^ ((uint64_t)(uint32_t)tone->us << 32), ctr++);
+    }
+    return key;
+}
+
+/// Read a checkpoint matching the key, returns -1 if there is none.
+static int checkpoint_load(char const *path, uint64_t key, checkpoint_t *cp)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    size_t n = fread(cp, sizeof(*cp), 1, fp);
+    fclose(fp);
+    if (n != 1 || cp->magic != CHECKPOINT_MAGIC || cp->size != sizeof(*cp)) {
+        fprintf(stderr, "Ignoring the unreadable checkpoint \"%s\".\n", path);
+        return -1;
+    }
+    if (cp->key != key) {
+        fprintf(stderr, "Ignoring the checkpoint \"%s\" of a different render.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/// Flush the output to disk, then replace the checkpoint with the state after samples [0, t) of tone k.
+static void checkpoint_save(ctx_t *ctx, char const *path, uint64_t key, size_t k, size_t t)
+{
+    signal_out_flush(ctx);
+    off_t pos = lseek(ctx->fd, 0, SEEK_CUR);
+#ifndef _WIN32
+    fsync(ctx->fd);
+#endif
+
+    checkpoint_t cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.magic        = CHECKPOINT_MAGIC;
+    cp.size         = sizeof(cp);
+    cp.key          = key;
+    cp.tone         = k;
+    cp.t            = t;
+    cp.out_pos      = (uint64_t)pos;
+    cp.phi          = ctx->phi;
+    cp.filter_state = ctx->filter_state;
+
+    // written aside and renamed, a checkpoint is never torn
+    size_t len = strlen(path);
+    char *tmp  = malloc(len + 5);
+    if (!tmp) {
+        fprintf(stderr, "Failed to allocate checkpoint path.\n");
+        exit(1);
+    }
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *fp = fopen(tmp, "wb");
+    int fail = !fp || fwrite(&cp, sizeof(cp), 1, fp) != 1;
+    if (fp && fclose(fp))
+        fail = 1;
+#ifdef _WIN32
+    remove(path); // rename does not replace
+#endif
+    if (fail || rename(tmp, path)) {
+        fprintf(stderr, "Failed to write the checkpoint \"%s\" (%s).\n", path, strerror(errno));
+    }
+    free(tmp);
+}
+
+/// Render to a file serially from the plan, with checkpoints, resuming from a matching checkpoint.
+size_t iq_render_checkpointed(ctx_t *ctx, char const *outpath, iq_render_t const *spec, tone_t *tones)
+{
+    char const *path = spec->checkpoint;
+    unsigned every   = spec->checkpoint_s ? spec->checkpoint_s : 10;
+    uint64_t key     = checkpoint_key(ctx, spec, tones);
+
+    render_plan(ctx, tones);
+    render_cut_t cut = {0, 0, 0};
+
+    checkpoint_t cp;
+    int resume = checkpoint_load(path, key, &cp) == 0 && cp.tone <= ctx->plan_len
+            && cp.t <= ctx->plan[cp.tone].len;
+    ctx->fd = open(outpath, O_CREAT | O_WRONLY | (resume ? 0 : O_TRUNC), 0644);
+    if (ctx->fd < 0) {
+        fprintf(stderr, "Failed to open output \"%s\" (%s).\n", outpath, strerror(errno));
+        exit(1);
+    }
+#ifndef _WIN32
+    struct stat st;
+    ctx->sparse = fstat(ctx->fd, &st) == 0 && S_ISREG(st.st_mode) && zero_block_is_zero(ctx);
+#endif
+
+    if (resume) {
+        // drop the output written after the checkpoint
+#ifdef _WIN32
+        int fail = _chsize_s(ctx->fd, (__int64)cp.out_pos) != 0;
+#else
+        int fail = ftruncate(ctx->fd, (off_t)cp.out_pos) != 0;
+#endif
+        if (fail || lseek(ctx->fd, (off_t)cp.out_pos, SEEK_SET) < 0) {
+            fprintf(stderr, "Failed to resume the output \"%s\" (%s).\n", outpath, strerror(errno));
+            exit(1);
+        }
+        cut = (render_cut_t){(size_t)cp.tone, (size_t)cp.t, ctx->plan[cp.tone].start};
+    }
+    render_seek(ctx, &cut);
+    if (resume) {
+        if (ctx->phi != cp.phi) {
+            fprintf(stderr, "The checkpoint \"%s\" does not match the render.\n", path);
+            exit(1);
+        }
+        ctx->filter_state = cp.filter_state;
+        fprintf(stderr, "Resuming at sample %zu.\n", ctx->smp_pos);
+    }
+
+    time_t last = time(NULL);
+    size_t k    = cut.tone;
+    size_t t    = cut.t;
+    for (; k < ctx->plan_len && !render_aborted(ctx); ++k, t = 0) {
+        if (k != cut.tone)
+            plan_begin(ctx, k);
+        while (t < ctx->tone_len && !render_aborted(ctx)) {
+            size_t len = ctx->tone_len - t < RENDER_CHUNK ? ctx->tone_len - t : RENDER_CHUNK;
+            tone_render(ctx, t, t + len);
+            t += len;
+            // after a failed write the output is short, the last checkpoint stays
+            if (!ctx->out_failed && (render_aborted(ctx) || time(NULL) - last >= (time_t)every)) {
+                checkpoint_save(ctx, path, key, k, t);
+                last = time(NULL);
+            }
+        }
+        if (render_aborted(ctx))
+            break;
+    }
+    signal_out_flush(ctx);
+
+    // a hole at the end needs the file extended
+    off_t end = lseek(ctx->fd, 0, SEEK_CUR);
+#ifndef _WIN32
+    if (ctx->sparse && end >= 0 && fstat(ctx->fd, &st) == 0 && st.st_size < end && ftruncate(ctx->fd, end)) {
+        fprintf(stderr, "Failed to extend the output file.\n");
+        ctx->out_failed = 1;
+    }
+#endif
+    if (!render_aborted(ctx))
+        remove(path);
+
+    free(ctx->plan);
+    ctx->plan = NULL;
+    return (size_t)((double)end / ctx->sample_size * 1000000.0 / ctx->sample_rate);
+}
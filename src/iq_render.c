@@ -17,8 +17,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "iq_render.h"
-#include "sample.h"
+#include "iq_render_ctx.h"
 
 #include <errno.h>
 #include <signal.h>
@@ -29,6 +28,8 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -44,137 +45,116 @@
 
 #include <time.h>
 
-#include "nco.h"
+#include "noise.h"
 
-int abort_render = 0;
+// stats
 
-
-#define MAX_STEP_SIZE 1000
-
-/// Filter state.
-typedef struct filter_state {
-    double a[2 + 1]; // up to 2nd order
-    double b[2 + 1]; // up to 2nd order
-    double yi[2];
-    double xi[2];
-    double yq[2];
-    double xq[2];
-} filter_state_t;
-
-// render context
-
-typedef struct ctx ctx_t;
-
-typedef void (*signal_out_fn)(ctx_t *ctx, double i, double q);
-
-struct ctx {
-    double sample_rate;
-    double noise_floor;  ///< peak-to-peak (-19 dB)
-    double noise_signal; ///< peak-to-peak (-25 dB)
-    double gain;         ///< sine-peak (-0 dB)
-
-    enum sample_format sample_format;
-    double full_scale;
-    size_t frame_size;
-
-    size_t frame_len;
-    size_t frame_pos;
-    frame_t frame;
-    int fd;
-
-    signal_out_fn signal_out;
-
-    int g_db;     ///< continuous db
-    double g_hz;  ///< continuous freq
-    uint32_t phi; ///< continuous phase
-
-    double step_out[MAX_STEP_SIZE];
-    double step_in[MAX_STEP_SIZE];
-    size_t step_len;
-
-    filter_state_t filter_state;
-};
-
-// helper
-
-static double noise_pp_level(double level)
+/// Monotonic wall time in seconds.
+double stats_now(void)
 {
-    if (level < 0)
-        level = pow(10.0, 1.0 / 20.0 * level);
-    // correct for RMS to equal a sine
-    return level * 2 * sqrt(1.0 / 2.0 * 3.0 / 2.0);
-}
-
-static double sine_pk_level(double level)
-{
-    if (level <= 0)
-        level = pow(10.0, 1.0 / 20.0 * level);
-    return level;
-}
-
-static inline double randf(void)
-{
-    // hotspot:
-    return (double)rand() / RAND_MAX;
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
 }
 
-static inline uint8_t bound_u4(int x)
+/// Start the clocks, the counters start at zero.
+void stats_begin(ctx_t *ctx)
 {
-    return x < 0 ? 0 : x > 0xf ? 0xf : (uint8_t)x;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats_wall = stats_now();
+    ctx->stats_cpu  = clock();
+    ctx->stats_lap  = ctx->stats_wall;
 }
 
-static inline int8_t bound_s4(int x)
+/// Add the counters of another context, e.g. of a thread.
+void stats_add(iq_render_stats_t *dst, iq_render_stats_t const *src)
 {
-    return x < -0x8 ? -0x8 : x > 0x7 ? 0x7 : (int8_t)x;
+    dst->samples += src->samples;
+    dst->silent += src->silent;
+    dst->clipped += src->clipped;
+    dst->osc_s += src->osc_s;
+    dst->noise_s += src->noise_s;
+    dst->filter_s += src->filter_s;
+    dst->pack_s += src->pack_s;
+    dst->write_s += src->write_s;
 }
 
-static inline uint8_t bound_u8(int x)
+/// Stop the clocks and add the stats to the requested stats, returns the wall time in ms.
+double stats_end(ctx_t *ctx)
 {
-    return x < 0 ? 0 : x > 0xff ? 0xff : (uint8_t)x;
+    ctx->stats.wall_s = stats_now() - ctx->stats_wall;
+    ctx->stats.cpu_s  = (double)(clock() - ctx->stats_cpu) / CLOCKS_PER_SEC;
+    if (ctx->stats_out) {
+        stats_add(ctx->stats_out, &ctx->stats);
+        ctx->stats_out->wall_s += ctx->stats.wall_s;
+        ctx->stats_out->cpu_s += ctx->stats.cpu_s;
+    }
+    return ctx->stats.wall_s * 1000.0;
 }
 
-static inline int8_t bound_s8(int x)
+/// Count the samples with I or Q beyond full scale.
+static size_t clip_count(double const *buf_i, double const *buf_q, size_t len)
 {
-    return x < -0x80 ? -0x80 : x > 0x7f ? 0x7f : (int8_t)x;
+    size_t n = 0;
+    for (size_t t = 0; t < len; ++t)
+        n += fabs(buf_i[t]) > 1.0 || fabs(buf_q[t]) > 1.0;
+    return n;
 }
 
-static inline uint16_t bound_u16(int x)
+static size_t clip_countf(float const *buf_i, float const *buf_q, size_t len)
 {
-    return x < 0 ? 0 : x > 0xffff ? 0xffff : (uint16_t)x;
+    size_t n = 0;
+    for (size_t t = 0; t < len; ++t)
+        n += fabsf(buf_i[t]) > 1.0f || fabsf(buf_q[t]) > 1.0f;
+    return n;
 }
 
-static inline int16_t bound_s16(int x)
+static size_t clip_countq(int32_t const *buf_i, int32_t const *buf_q, size_t len)
 {
-    return x < -0x8000 ? -0x8000 : x > 0x7fff ? 0x7fff : (int16_t)x;
+    size_t n = 0;
+    for (size_t t = 0; t < len; ++t)
+        n += buf_i[t] > 32768 || buf_i[t] < -32768 || buf_q[t] > 32768 || buf_q[t] < -32768;
+    return n;
 }
 
-static inline uint32_t bound_u32(double x)
+static double noise_pp_level(double level)
 {
-    return x < 0 ? 0 : x > 0xffffffff ? 0xffffffff : (uint32_t)x;
+    if (level < 0)
+        level = pow(10.0, 1.0 / 20.0 * level);
+    // correct for RMS to equal a sine
+    return level * 2 * sqrt(1.0 / 2.0 * 3.0 / 2.0);
 }
 
-static inline int32_t bound_s32(double x)
+/// Per channel noise RMS for a SNR in dB against a full band complex tone of peak gain.
+static double noise_snr_rms(double snr_db, double gain)
 {
-    return x < -0x7fffffff ? -0x7fffffff : x > 0x7fffffff ? 0x7fffffff : (int32_t)x;
+    // tone power is gain^2, noise power is 2 * rms^2
+    return gain / sqrt(2.0 * pow(10.0, 1.0 / 10.0 * snr_db));
 }
 
-static inline uint64_t bound_u64(double x)
+/// Multiplier for unit noise values, levels are peak-to-peak of uniform noise.
+static double noise_mode_scale(enum noise_mode mode, double pp)
 {
-    return x < 0 ? 0 : x > 0xffffffffffffffff ? 0xffffffffffffffff : (uint64_t)x;
+    if (mode == NOISE_GAUSSIAN)
+        return pp / sqrt(12.0); // same RMS as the uniform noise
+    return pp;
 }
 
-static inline int64_t bound_s64(double x)
+static double sine_pk_level(double level)
 {
-    return x < -0x7fffffffffffffff ? -0x7fffffffffffffff : x > 0x7fffffffffffffff ? 0x7fffffffffffffff : (int64_t)x;
+    if (level <= 0)
+        level = pow(10.0, 1.0 / 20.0 * level);
+    return level;
 }
 
-// inlines
-
-static inline void signal_out_flush(ctx_t *ctx)
-{
-    write(ctx->fd, ctx->frame.u8, ctx->frame_len);
-    ctx->frame_pos = ctx->frame_len = 0;
-}
+// output
 
 static inline void signal_out_maybe_flush(ctx_t *ctx)
 {
@@ -183,211 +163,270 @@ static inline void signal_out_maybe_flush(ctx_t *ctx)
     }
 }
 
-static void signal_out_cu4(ctx_t *ctx, double i, double q)
-{
-    // scale [-1.0, 1.0] to [0, 15] with uniform distribution,
-    // i.e. bias 7.5 -- not Excess-8
-    // this exact scale prevents 1.0==16
-    uint8_t i8 = bound_u4((int)(i * 7.999999 + 7.5 + 0.5));
-    uint8_t q8 = bound_u4((int)(q * 7.999999 + 7.5 + 0.5));
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(i8 << 4) | (q8);
-    ctx->frame_len += 1 * sizeof(uint8_t);
-}
+static double const scale_defaults[] = {
+        127.5,
+        7.999999,
+        7.49999,
+        127.999999,
+        127.4999,
+        2047.999999,
+        2047.4999,
+        32767.999999,
+        32767.4999,
+        2147483647.999999,
+        2147483647.4999,
+        9223372036854775999.999999,
+        9223372036854775999.4999,
+        1.0,
+        1.0,
+};
 
-static void signal_out_cs4(ctx_t *ctx, double i, double q)
-{
-    // scale [-1.0, 1.0] to [-7, 7] with uniform distribution
-    // this exact scale prevents 1.0==8, -1.0==-8
-    int8_t i8 = bound_s4((int)(i * 7.49999 + 8 + 0.5) - 8);
-    int8_t q8 = bound_s4((int)(q * 7.49999 + 8 + 0.5) - 8);
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(i8 << 4) | (q8 & 0xf);
-    ctx->frame_len += 1 * sizeof(uint8_t);
-}
+// signal gen
 
-static void signal_out_cu8(ctx_t *ctx, double i, double q)
+/// Build the transition tables for a step width of any length, the tables are used for amplitude and frequency.
+static void init_step(ctx_t *ctx, size_t time_us, enum step_shape shape)
 {
-    // scale [-1.0, 1.0] to [0, 255] with uniform distribution,
-    // i.e. bias 127.5 -- not Excess-128
-    // this exact scale prevents 1.0==256
-    uint8_t i8 = bound_u8((int)(i * 127.999999 + 127.5 + 0.5));
-    uint8_t q8 = bound_u8((int)(q * 127.999999 + 127.5 + 0.5));
-    ctx->frame.u8[ctx->frame_pos++] = i8;
-    ctx->frame.u8[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(uint8_t);
-}
+    size_t len = (size_t)(time_us * ctx->sample_rate / 1000000.0);
 
-static void signal_out_cs8(ctx_t *ctx, double i, double q)
-{
-    // scale [-1.0, 1.0] to [-127, 127] with uniform distribution
-    // this exact scale prevents 1.0==128, -1.0==-128
-    int8_t i8 = bound_s8((int)(i * 127.4999 + 128 + 0.5) - 128);
-    int8_t q8 = bound_s8((int)(q * 127.4999 + 128 + 0.5) - 128);
-    ctx->frame.s8[ctx->frame_pos++] = i8;
-    ctx->frame.s8[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(int8_t);
+    uint8_t *mem = malloc((len + 1) * (3 * sizeof(double) + 2 * sizeof(float) + 2 * sizeof(int32_t)));
+    if (!mem) {
+        fprintf(stderr, "Failed to allocate step tables of %zu samples.\n", len);
+        exit(1);
+    }
+    ctx->step_len  = len;
+    ctx->step_out  = (double *)mem;
+    ctx->step_in   = ctx->step_out + len + 1;
+    ctx->step_sum  = ctx->step_in + len + 1;
+    ctx->step_outf = (float *)(ctx->step_sum + len + 1);
+    ctx->step_inf  = ctx->step_outf + len + 1;
+    ctx->step_outq = (int32_t *)(ctx->step_inf + len + 1);
+    ctx->step_inq  = ctx->step_outq + len + 1;
+
+    // gaussian edge, the erf over -edge to edge scaled to 0 to 1
+    double const edge = 2.5;
+    double sum = 0.0;
+    for (size_t t = 0; t < len; ++t) {
+        double x = t / (double)len;
+        if (shape == STEP_COSINE) {
+            ctx->step_in[t]  = 0.5 - 0.5 * cos(M_PI * x);
+            ctx->step_out[t] = 1.0 - ctx->step_in[t];
+        }
+        else if (shape == STEP_GAUSSIAN) {
+            ctx->step_in[t]  = 0.5 + 0.5 * erf(edge * (2.0 * x - 1.0)) / erf(edge);
+            ctx->step_out[t] = 1.0 - ctx->step_in[t];
+        }
+        else {
+            // naive linear stepping
+            ctx->step_out[t] = (len - t) / (double)len;
+            ctx->step_in[t]  = t / (double)len;
+        }
+        ctx->step_outf[t] = (float)ctx->step_out[t];
+        ctx->step_inf[t]  = (float)ctx->step_in[t];
+        ctx->step_outq[t] = (int32_t)lrint(ctx->step_out[t] * 32768.0);
+        ctx->step_inq[t]  = (int32_t)lrint(ctx->step_in[t] * 32768.0);
+        ctx->step_sum[t]  = sum;
+        sum += ctx->step_out[t];
+    }
+    ctx->step_sum[len] = sum;
 }
 
-static void signal_out_cu12(ctx_t *ctx, double i, double q)
+/// Build the GFSK frequency pulse for a bandwidth-time product, once per render.
+/// The NRZ frequency through a gaussian filter is a sum of gaussian steps at the tone changes,
+/// the table holds the prefix sums of the residual of a step, which is the phase over the step.
+static void init_gauss(ctx_t *ctx, double bt, double symbol_rate)
 {
-    uint16_t i8 = bound_u16((int)((i + 1.0) * ctx->full_scale));
-    uint16_t q8 = bound_u16((int)((q + 1.0) * ctx->full_scale));
-    // produce 24 bit (iiqIQQ), note the input is LSB aligned, scale=2048
-    // note: byte0 = i[7:0]; byte1 = {q[3:0], i[11:8]}; byte2 = q[11:4];
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(i8);
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(q8 >> 4);
-    ctx->frame_len += 3 * sizeof(uint8_t);
-    // NOTE: frame_size needs to be a multiple of 3!
-}
+    ctx->freq_c  = ctx->step_sum;
+    ctx->freq_n  = ctx->step_len;
+    ctx->freq_lo = 0;
+    if (bt <= 0.0)
+        return;
+    if (symbol_rate <= 0.0) {
+        fprintf(stderr, "GFSK needs a symbol rate.\n");
+        exit(1);
+    }
 
-static void signal_out_cs12(ctx_t *ctx, double i, double q)
-{
-    int16_t i8 = bound_s16((int)(i * ctx->full_scale + 2048 + 0.5) - 2048);
-    int16_t q8 = bound_s16((int)(q * ctx->full_scale + 2048 + 0.5) - 2048);
-    // produce 24 bit (iiqIQQ), note the input is LSB aligned, scale=2048
-    // note: byte0 = i[7:0]; byte1 = {q[3:0], i[11:8]}; byte2 = q[11:4];
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(i8);
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
-    ctx->frame.u8[ctx->frame_pos++] = (uint8_t)(q8 >> 4);
-    ctx->frame_len += 3 * sizeof(uint8_t);
-    // NOTE: frame_size needs to be a multiple of 3!
-}
+    double sigma = sqrt(log(2.0)) / (2.0 * M_PI * bt) * ctx->sample_rate / symbol_rate;
+    size_t half  = (size_t)ceil(5.0 * sigma) + 1;
+    ctx->gauss_c = malloc((2 * half + 1) * sizeof(*ctx->gauss_c));
+    if (!ctx->gauss_c) {
+        fprintf(stderr, "Failed to allocate GFSK table of %zu samples.\n", 2 * half);
+        exit(1);
+    }
+    // the step is between samples -1 and 0, the residual is the unit step minus the gaussian step
+    double sum = 0.0;
+    for (size_t k = 0; k < 2 * half; ++k) {
+        double m = (double)k - (double)half + 0.5;
+        double s = 0.5 + 0.5 * erf(m / (sigma * M_SQRT2));
+        ctx->gauss_c[k] = sum;
+        sum += m > 0.0 ? 1.0 - s : -s;
+    }
+    ctx->gauss_c[2 * half] = sum;
 
-static void signal_out_cu16(ctx_t *ctx, double i, double q)
-{
-    uint16_t i8 = bound_u16((int)((i + 1.0) * ctx->full_scale));
-    uint16_t q8 = bound_u16((int)((q + 1.0) * ctx->full_scale));
-    ctx->frame.u16[ctx->frame_pos++] = i8;
-    ctx->frame.u16[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(uint16_t);
+    ctx->freq_c    = ctx->gauss_c;
+    ctx->freq_n    = 2 * half;
+    ctx->freq_lo   = -(ptrdiff_t)half;
+    ctx->freq_step = 0; // the gaussian steps replace the ramps
 }
 
-static void signal_out_cs16(ctx_t *ctx, double i, double q)
+static void edges_add(ctx_t *ctx, ptrdiff_t pos, uint32_t d_from, uint32_t d_to)
 {
-    int16_t i8 = bound_s16((int)(i * ctx->full_scale + 32768 + 0.5) - 32768);
-    int16_t q8 = bound_s16((int)(q * ctx->full_scale + 32768 + 0.5) - 32768);
-    ctx->frame.s16[ctx->frame_pos++] = i8;
-    ctx->frame.s16[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(int16_t);
+    if (d_from == d_to)
+        return;
+    if (ctx->edges == MAX_FREQ_EDGES) {
+        fprintf(stderr, "Too many frequency steps in a tone, the tones are too short for the pulse.\n");
+        exit(1);
+    }
+    ctx->edge[ctx->edges++] = (freq_edge_t){pos, (double)((int64_t)(int32_t)d_from - (int32_t)d_to)};
 }
 
-static void signal_out_cu32(ctx_t *ctx, double i, double q)
+/// Find the samples of the current tone in a step, and the cache key of the steps.
+static void edges_end(ctx_t *ctx)
 {
-    uint32_t i8 = bound_u32((i + 1.0) * ctx->full_scale);
-    uint32_t q8 = bound_u32((q + 1.0) * ctx->full_scale);
-    ctx->frame.u32[ctx->frame_pos++] = i8;
-    ctx->frame.u32[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(uint32_t);
+    size_t head = 0;
+    size_t tail = ctx->tone_len;
+    uint64_t key = 0;
+    for (unsigned k = 0; k < ctx->edges; ++k) {
+        freq_edge_t const *e = &ctx->edge[k];
+        ptrdiff_t end = e->pos + (ptrdiff_t)ctx->freq_n;
+        if (e->pos - ctx->freq_lo <= 0 && end > 0 && (size_t)end > head)
+            head = (size_t)end; // a step of this tone or before
+        else if (e->pos - ctx->freq_lo > 0 && (e->pos <= 0 || (size_t)e->pos < tail))
+            tail = e->pos > 0 ? (size_t)e->pos : 0; // a step of the following tones
+        uint64_t d;
+        memcpy(&d, &e->delta, sizeof(d));
+        key = noise_hash(key ^ d, (uint64_t)e->pos);
+    }
+    ctx->ramp_head = head;
+    ctx->ramp_tail = tail;
+    ctx->edge_key  = key;
 }
 
-static void signal_out_cs32(ctx_t *ctx, double i, double q)
+/// The frequency steps of the current tone without a plan, a ramp from d_from.
+static void tone_edges(ctx_t *ctx)
 {
-    int32_t i8 = bound_s32(i * ctx->full_scale);
-    int32_t q8 = bound_s32(q * ctx->full_scale);
-    ctx->frame.s32[ctx->frame_pos++] = i8;
-    ctx->frame.s32[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(int32_t);
+    ctx->edges = 0;
+    edges_add(ctx, 0, ctx->d_from, ctx->d_phi);
+    edges_end(ctx);
 }
 
-static void signal_out_cu64(ctx_t *ctx, double i, double q)
+/// Samples from t0 on up to len which are all in a step, or all steady.
+static size_t ramp_run(ctx_t const *ctx, size_t t0, size_t len, int *ramp)
 {
-    uint64_t i8 = bound_u64((i + 1.0) * ctx->full_scale);
-    uint64_t q8 = bound_u64((q + 1.0) * ctx->full_scale);
-    ctx->frame.u64[ctx->frame_pos++] = i8;
-    ctx->frame.u64[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(uint64_t);
+    size_t end = t0 + len;
+    *ramp      = t0 < ctx->ramp_head || t0 >= ctx->ramp_tail;
+    if (*ramp && t0 < ctx->ramp_tail && ctx->ramp_head < ctx->ramp_tail && ctx->ramp_head < end)
+        end = ctx->ramp_head;
+    else if (!*ramp && ctx->ramp_tail < end)
+        end = ctx->ramp_tail;
+    return end - t0;
 }
 
-static void signal_out_cs64(ctx_t *ctx, double i, double q)
+/// Largest pole radius of a biquad, the state decays with it.
+static double biquad_radius(double a1, double a2)
 {
-    int64_t i8 = bound_s64(i * ctx->full_scale);
-    int64_t q8 = bound_s64(q * ctx->full_scale);
-    ctx->frame.s64[ctx->frame_pos++] = i8;
-    ctx->frame.s64[ctx->frame_pos++] = q8;
-    ctx->frame_len += 2 * sizeof(int64_t);
+    double disc = a1 * a1 + 4.0 * a2;
+    return disc < 0 ? sqrt(-a2) : (fabs(a1) + sqrt(disc)) / 2.0;
 }
 
-static void signal_out_cf32(ctx_t *ctx, double i, double q)
+/// Samples for a state to decay well below double precision.
+static size_t decay_warmup(double r)
 {
-    ctx->frame.f32[ctx->frame_pos++] = (float)(i * ctx->full_scale);
-    ctx->frame.f32[ctx->frame_pos++] = (float)(q * ctx->full_scale);
-    ctx->frame_len += 2 * sizeof(float);
+    double n = r < 1.0 ? -128.0 * log(2.0) / log(r) : MAX_WARMUP;
+    return n < MAX_WARMUP ? (size_t)n + 2 : MAX_WARMUP;
 }
 
-static void signal_out_cf64(ctx_t *ctx, double i, double q)
+/// Butterworth of even order as cascaded biquads, one per conjugate pole pair.
+static void init_filter_sections(ctx_t *ctx, double wc, unsigned order)
 {
-    ctx->frame.f64[ctx->frame_pos++] = (double)(i * ctx->full_scale);
-    ctx->frame.f64[ctx->frame_pos++] = (double)(q * ctx->full_scale);
-    ctx->frame_len += 2 * sizeof(double);
+    double ita = 1.0 / tan(M_PI * wc);
+    double r   = 0.0;
+
+    ctx->sections = order / 2;
+    for (size_t k = 0; k < ctx->sections; ++k) {
+        // q is 1 / Q of the pole pair, sqrt(2) for 2nd order
+        double q  = 2.0 * cos(M_PI * (2 * k + 1) / (2.0 * order));
+        double b0 = 1.0 / (1.0 + q * ita + ita * ita);
+        double a1 = 2.0 * (ita * ita - 1.0) * b0;
+        double a2 = -(1.0 - q * ita + ita * ita) * b0;
+        ctx->sec_a[k][0] = 1.0, ctx->sec_a[k][1] = a1, ctx->sec_a[k][2] = a2;
+        ctx->sec_b[k][0] = b0, ctx->sec_b[k][1] = 2 * b0, ctx->sec_b[k][2] = b0;
+        double rk = biquad_radius(a1, a2);
+        if (rk > r)
+            r = rk;
+    }
+    // the slowest section sets the decay, the others add about their length
+    ctx->filter_warmup = decay_warmup(r) * 2;
+    if (ctx->filter_warmup > MAX_WARMUP)
+        ctx->filter_warmup = MAX_WARMUP;
 }
 
-static signal_out_fn format_out[] = {
-        signal_out_cu8,
-        signal_out_cu4,
-        signal_out_cs4,
-        signal_out_cu8,
-        signal_out_cs8,
-        signal_out_cu12,
-        signal_out_cs12,
-        signal_out_cu16,
-        signal_out_cs16,
-        signal_out_cu32,
-        signal_out_cs32,
-        signal_out_cu64,
-        signal_out_cs64,
-        signal_out_cf32,
-        signal_out_cf64,
-};
-static double scale_defaults[] = {
-        127.5,
-        7.999999,
-        7.49999,
-        127.999999,
-        127.4999,
-        2047.999999,
-        2047.4999,
-        32767.999999,
-        32767.4999,
-        2147483647.999999,
-        2147483647.4999,
-        9223372036854775999.999999,
-        9223372036854775999.4999,
-        1.0,
-        1.0,
-};
-
-// signal gen
-
-static void init_step(ctx_t *ctx, size_t time_us)
+/// Linear-phase FIR, a Blackman windowed sinc of odd length with unity gain at DC.
+static void init_filter_fir(ctx_t *ctx, double wc, unsigned taps)
 {
-    ctx->step_len = (size_t)(time_us * ctx->sample_rate / 1000000.0);
-    if (ctx->step_len > MAX_STEP_SIZE)
-        ctx->step_len = MAX_STEP_SIZE;
-    //uint32_t l_phi = 0;
-    //uint32_t d_phi = nco_d_phase(1000000 / 2 / time_us, (size_t)ctx->sample_rate);
-    for (size_t t = 0; t < ctx->step_len; ++t) {
-        // naive linear stepping
-        ctx->step_out[t] = (ctx->step_len - t) / (double)ctx->step_len;
-        ctx->step_in[t]  = t / (double)ctx->step_len;
-
-        //ctx->step_out[t] = (nco_cos(l_phi) + 1) / 2;
-        //printf("at %2d : %f\n", t, ctx->step_out[t]);
-        //ctx->step_in[t]  = 1.0 - ctx->step_out[t];
-        //l_phi += d_phi;
+    size_t center = taps / 2;
+    double sum    = 0.0;
+
+    ctx->fir_len = taps;
+    for (size_t j = 0; j < taps; ++j) {
+        double x = 2.0 * wc * ((double)j - (double)center);
+        double h = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+        double w = 0.42 - 0.5 * cos(M_PI * j / center) + 0.08 * cos(2.0 * M_PI * j / center);
+        ctx->fir_h[j] = h * w;
+        sum += h * w;
     }
+    for (size_t j = 0; j < taps; ++j)
+        ctx->fir_h[j] /= sum;
+    // the history is all of the state
+    ctx->filter_warmup = taps - 1;
 }
 
-static void init_filter(ctx_t *ctx, double wc)
+static void init_filter(ctx_t *ctx, double wc, enum filter_type type, unsigned order)
 {
     // wc is the ratio of cutoff and sampling freq: wc = f_cutoff / f_sampling
     // [b,a] = butter(2, Wc) # low pass filter with cutoff pi*Wc radians
 
+    ctx->filter_long = 0;
+    ctx->sections    = 0;
+    ctx->fir_len     = 0;
+
     if (wc >= 0.5) {
         // flat, no filter
         ctx->filter_state = (filter_state_t){
                 .a = {1.00000, 0.00000, 0.00000},
                 .b = {1.00000, 0.00000, 0.00000},
         };
+        ctx->filter_warmup = 2; // just the history
+        ctx->filter_on     = 0;
+        return;
+    }
+
+    if (type == FILTER_FIR) {
+        unsigned taps = order ? order : DEFAULT_FIR_TAPS;
+        if (taps > MAX_FIR_TAPS)
+            taps = MAX_FIR_TAPS;
+        if (taps < 3)
+            taps = 3;
+        if (taps % 2 == 0)
+            taps += 1;
+        if (order && taps != order)
+            fprintf(stderr, "Adjusting FIR taps from %u to %u.\n", order, taps);
+        ctx->filter_state = (filter_state_t){.a = {1.0}, .b = {1.0}};
+        init_filter_fir(ctx, wc, taps);
+        ctx->filter_on   = 1;
+        ctx->filter_long = 1;
+        return;
+    }
+
+    unsigned even = order ? order + order % 2 : 2;
+    if (even > 2 * MAX_SECTIONS)
+        even = 2 * MAX_SECTIONS;
+    if (order && even != order)
+        fprintf(stderr, "Adjusting filter order from %u to %u.\n", order, even);
+    if (even > 2) {
+        ctx->filter_state = (filter_state_t){.a = {1.0}, .b = {1.0}};
+        init_filter_sections(ctx, wc, even);
+        ctx->filter_on   = 1;
+        ctx->filter_long = 1;
         return;
     }
 
@@ -406,275 +445,2239 @@ static void init_filter(ctx_t *ctx, double wc)
             .a = {1.00000, a1, a2},
             .b = {b0, b1, b2},
     };
+
+    // the state decays with the largest pole radius, settle well below double precision
+    ctx->filter_warmup = decay_warmup(biquad_radius(a1, a2));
+    ctx->filter_on     = 1;
 }
 
-static inline double apply_filter_i(ctx_t *ctx, double x)
+static void init_filterf(ctx_t *ctx)
 {
-    double *xi = ctx->filter_state.xi;
-    double *yi = ctx->filter_state.yi;
-    double *a = ctx->filter_state.a;
-    double *b = ctx->filter_state.b;
-
-    double y = a[1] * yi[0]
-               + a[2] * yi[1]
-               + b[0] * x
-               + b[1] * xi[0]
-               + b[2] * xi[1];
-
-    xi[1] = xi[0];
-    xi[0] = x;
-    yi[1] = yi[0];
-    yi[0] = y;
-
-    return y;
+    filter_state_t *fs = &ctx->filter_state;
+    for (int k = 0; k < 3; ++k) {
+        fs->af[k] = (float)fs->a[k];
+        fs->bf[k] = (float)fs->b[k];
+        fs->aq[k] = (int32_t)lrint(fs->a[k] * (1 << 28));
+        fs->bq[k] = (int32_t)lrint(fs->b[k] * (1 << 28));
+    }
+    for (size_t s = 0; s < ctx->sections; ++s) {
+        for (int k = 0; k < 3; ++k) {
+            ctx->sec_af[s][k] = (float)ctx->sec_a[s][k];
+            ctx->sec_bf[s][k] = (float)ctx->sec_b[s][k];
+        }
+    }
+    for (size_t j = 0; j < ctx->fir_len; ++j)
+        ctx->fir_hf[j] = (float)ctx->fir_h[j];
 }
 
-static inline double apply_filter_q(ctx_t *ctx, double x)
+/// Level as Q15, limited to below 2.0 to keep products in 32 bits.
+static int32_t level_q15(double level)
 {
-    double *xq = ctx->filter_state.xq;
-    double *yq = ctx->filter_state.yq;
-    double *a  = ctx->filter_state.a;
-    double *b  = ctx->filter_state.b;
-
-    double y = a[1] * yq[0]
-               + a[2] * yq[1]
-               + b[0] * x
-               + b[1] * xq[0]
-               + b[2] * xq[1];
+    double q = level * 32768.0;
+    return q > 65535.0 ? 65535 : (int32_t)lrint(q);
+}
 
-    xq[1] = xq[0];
-    xq[0] = x;
-    yq[1] = yq[0];
-    yq[0] = y;
+// block stages
+
+/// A block stage working on the block buffers of a context.
+typedef void (*render_stage_fn)(ctx_t *ctx, size_t len);
+
+/// Instance a kernel for each combination of noise on signal, filter, and noise floor.
+/// The flags are constants in each instance, the compiler drops the unused work and branches.
+/// Defines the table kernel##s, indexed by render_kernel_index().
+#define RENDER_KERNELS(kernel) \
+    static void kernel##_000(ctx_t *ctx, size_t len) { kernel(ctx, len, 0, 0, 0); } \
+    static void kernel##_001(ctx_t *ctx, size_t len) { kernel(ctx, len, 0, 0, 1); } \
+    static void kernel##_010(ctx_t *ctx, size_t len) { kernel(ctx, len, 0, 1, 0); } \
+    static void kernel##_011(ctx_t *ctx, size_t len) { kernel(ctx, len, 0, 1, 1); } \
+    static void kernel##_100(ctx_t *ctx, size_t len) { kernel(ctx, len, 1, 0, 0); } \
+    static void kernel##_101(ctx_t *ctx, size_t len) { kernel(ctx, len, 1, 0, 1); } \
+    static void kernel##_110(ctx_t *ctx, size_t len) { kernel(ctx, len, 1, 1, 0); } \
+    static void kernel##_111(ctx_t *ctx, size_t len) { kernel(ctx, len, 1, 1, 1); } \
+    static render_stage_fn const kernel##s[8] = { \
+            kernel##_000, kernel##_001, kernel##_010, kernel##_011, \
+            kernel##_100, kernel##_101, kernel##_110, kernel##_111, \
+    };
 
-    return y;
+static inline unsigned render_kernel_index(int noise_s, int filter, int noise_f)
+{
+    return (noise_s ? 4 : 0) | (filter ? 2 : 0) | (noise_f ? 1 : 0);
 }
 
-static inline void add_sine(ctx_t *ctx, double freq_hz, size_t time_us, int db, int ph)
+void render_ramp(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
 {
-    //uint32_t g_phi = nco_d_phase((ssize_t)ctx->g_hz, (size_t)ctx->sample_rate);
-    uint32_t d_phi = nco_d_phase((ssize_t)freq_hz, (size_t)ctx->sample_rate);
-    // uint32_t phi = nco_phase((ssize_t)freq_hz, (size_t)ctx->sample_rate, global_time_us); // absolute phase
-    // uint32_t phi = 0; // relative phase
-
-    //printf("Phase delta: %u vs %u (%u to %u)\n", g_phi, d_phi,
-    //        (uint32_t)(ctx->step_out[0] * g_phi + ctx->step_in[0] * d_phi),
-    //        (uint32_t)(ctx->step_out[ctx->step_len-1] * g_phi + ctx->step_in[ctx->step_len-1] * d_phi));
-
-    // phase offset if requested
-    while (ph < 0)
-        ph += 360;
-    while (ph >= 360)
-        ph -= 360;
-    if (ph) {
-        ctx->phi += 11930465 * (uint32_t)ph; // (0x100000000 / 360)
+    double *buf_i = ctx->buf_i;
+    double *buf_q = ctx->buf_q;
+    double gain   = ctx->gain;
+
+    // ramp in and out
+    size_t t = 0;
+    for (; t < len && t0 + t < ctx->step_len; ++t) {
+        double att = ctx->step_out[t0 + t] * g_att + ctx->step_in[t0 + t] * n_att;
+        buf_i[t] = buf_i[t] * gain * att;
+        buf_q[t] = buf_q[t] * gain * att;
+    }
+    // steady
+    for (; t < len; ++t) {
+        buf_i[t] = buf_i[t] * gain * n_att;
+        buf_q[t] = buf_q[t] * gain * n_att;
     }
+}
 
-    double n_att = db_to_mag(db);
-    double g_att = db_to_mag(ctx->g_db);
-    ctx->g_db = db;
-    ctx->g_hz = freq_hz;
+/// Oscillator for samples [t0, t0 + len) of the current tone, LUT lookups over the frequency steps.
+void osc_block(ctx_t *ctx, size_t t0, size_t len)
+{
+    int interp = ctx->osc_out != nco_block_lut;
+    for (size_t t = 0, n; t < len; t += n) {
+        int ramp;
+        n = ramp_run(ctx, t0 + t, len - t, &ramp);
+        if (!ramp) {
+            ctx->phi = ctx->osc_out(ctx->phi, ctx->d_phi, n, ctx->buf_i + t, ctx->buf_q + t);
+            continue;
+        }
+        uint32_t base = ctx->phi - tone_phase(ctx, t0 + t);
+        for (size_t u = t; u < t + n; ++u) {
+            uint32_t phi  = base + tone_phase(ctx, t0 + u);
+            ctx->buf_i[u] = interp ? nco_cos_interp(phi) : nco_cos(phi);
+            ctx->buf_q[u] = interp ? nco_sin_interp(phi) : nco_sin(phi);
+        }
+        ctx->phi = base + tone_phase(ctx, t0 + t + n);
+    }
+}
 
-    size_t end = (size_t)(time_us * ctx->sample_rate / 1000000.0);
-    for (size_t t = 0; t < end; ++t) {
+static void render_osc(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
+{
+    osc_block(ctx, t0, len);
+    render_ramp(ctx, t0, len, g_att, n_att);
+}
 
-        // ramp in and out
-        double att = t < ctx->step_len ? ctx->step_out[t] * g_att + ctx->step_in[t] * n_att : n_att;
+void render_noise(ctx_t *ctx, size_t len)
+{
+    // noise depends only on the key and the sample position
+    if (ctx->noise_mode == NOISE_GAUSSIAN)
+        noise_gaussian_block(ctx->noise_key, ctx->smp_pos, len,
+                ctx->noise_si, ctx->noise_sq, ctx->noise_fi, ctx->noise_fq);
+    else
+        noise_uniform_block(ctx->noise_key, ctx->smp_pos, len,
+                ctx->noise_si, ctx->noise_sq, ctx->noise_fi, ctx->noise_fq);
+}
 
-        // complex I/Q
-        double i = nco_cos(ctx->phi) * ctx->gain * att;
-        double q = nco_sin(ctx->phi) * ctx->gain * att;
-        ctx->phi += d_phi;
-        //ctx->phi += t < ctx->step_len ? ctx->step_out[t] * g_phi + ctx->step_in[t] * d_phi : d_phi;
+static inline void render_disturb_kernel(ctx_t *ctx, size_t len, int noise_s, int filter, int noise_f)
+{
+    double *buf_i       = ctx->buf_i;
+    double *buf_q       = ctx->buf_q;
+    double noise_signal = ctx->noise_signal;
+    double noise_floor  = ctx->noise_floor;
+
+    // filter state in registers
+    filter_state_t *fs = &ctx->filter_state;
+    double a1 = fs->a[1], a2 = fs->a[2];
+    double b0 = fs->b[0], b1 = fs->b[1], b2 = fs->b[2];
+    double xi0 = fs->xi[0], xi1 = fs->xi[1], yi0 = fs->yi[0], yi1 = fs->yi[1];
+    double xq0 = fs->xq[0], xq1 = fs->xq[1], yq0 = fs->yq[0], yq1 = fs->yq[1];
+
+    for (size_t t = 0; t < len; ++t) {
+        double i = buf_i[t];
+        double q = buf_q[t];
 
         // disturb
-        i += (randf() - 0.5) * ctx->noise_signal;
-        q += (randf() - 0.5) * ctx->noise_signal;
+        if (noise_s) {
+            i += ctx->noise_si[t] * noise_signal;
+            q += ctx->noise_sq[t] * noise_signal;
+        }
 
         // band limit
-        i = apply_filter_i(ctx, i);
-        q = apply_filter_q(ctx, q);
+        if (filter) {
+            double yi = a1 * yi0 + a2 * yi1 + b0 * i + b1 * xi0 + b2 * xi1;
+            double yq = a1 * yq0 + a2 * yq1 + b0 * q + b1 * xq0 + b2 * xq1;
+            xi1 = xi0, xi0 = i, yi1 = yi0, yi0 = yi;
+            xq1 = xq0, xq0 = q, yq1 = yq0, yq0 = yq;
+            i = yi;
+            q = yq;
+        }
 
         // disturb
-        i += (randf() - 0.5) * ctx->noise_floor;
-        q += (randf() - 0.5) * ctx->noise_floor;
+        if (noise_f) {
+            i += ctx->noise_fi[t] * noise_floor;
+            q += ctx->noise_fq[t] * noise_floor;
+        }
 
-        ctx->signal_out(ctx, i, q);
-        signal_out_maybe_flush(ctx);
+        buf_i[t] = i;
+        buf_q[t] = q;
     }
+
+    fs->xi[0] = xi0, fs->xi[1] = xi1, fs->yi[0] = yi0, fs->yi[1] = yi1;
+    fs->xq[0] = xq0, fs->xq[1] = xq1, fs->yq[0] = yq0, fs->yq[1] = yq1;
 }
 
-// api
+RENDER_KERNELS(render_disturb_kernel)
 
-size_t iq_render_length_us(tone_t *tones)
+/// Higher order band limit, I and Q are interleaved so each step works on both lanes.
+static void render_filter_long(ctx_t *ctx, size_t len)
 {
-    size_t signal_length_us = 0;
-
-    for (tone_t *tone = tones; (tone->us || tone->hz) && !abort_render; ++tone) {
-        signal_length_us += (size_t)tone->us;
+    filter_state_t *fs = &ctx->filter_state;
+    double *buf_i      = ctx->buf_i;
+    double *buf_q      = ctx->buf_q;
+
+    if (ctx->fir_len) {
+        size_t hist   = ctx->fir_len - 1;
+        double(*x)[2] = ctx->filter_iq;
+        memcpy(x, fs->fir, hist * sizeof(*x));
+        for (size_t t = 0; t < len; ++t)
+            x[hist + t][0] = buf_i[t], x[hist + t][1] = buf_q[t];
+
+        double const *h = ctx->fir_h;
+        for (size_t t = 0; t < len; ++t) {
+            double acc[2] = {0.0, 0.0};
+            double(*xt)[2] = &x[hist + t];
+            for (size_t k = 0; k <= hist; ++k)
+                for (int c = 0; c < 2; ++c)
+                    acc[c] += h[k] * xt[-(ptrdiff_t)k][c];
+            buf_i[t] = acc[0];
+            buf_q[t] = acc[1];
+        }
+        memcpy(fs->fir, x + len, hist * sizeof(*x));
+        return;
     }
 
-    return signal_length_us;
-}
-
-size_t iq_render_length_smp(iq_render_t *spec, tone_t *tones)
-{
-    if (spec->sample_rate == 0.0)
-        spec->sample_rate = DEFAULT_SAMPLE_RATE;
-    double sample_rate = spec->sample_rate;
-
-    size_t signal_length_samples = 0;
-
-    for (tone_t *tone = tones; (tone->us || tone->hz) && !abort_render; ++tone) {
-        size_t len = (size_t)(tone->us * sample_rate / 1000000.0);
-        signal_length_samples += len;
+    double(*x)[2] = ctx->filter_iq;
+    for (size_t t = 0; t < len; ++t)
+        x[t][0] = buf_i[t], x[t][1] = buf_q[t];
+
+    for (size_t s = 0; s < ctx->sections; ++s) {
+        double a1 = ctx->sec_a[s][1], a2 = ctx->sec_a[s][2];
+        double b0 = ctx->sec_b[s][0], b1 = ctx->sec_b[s][1], b2 = ctx->sec_b[s][2];
+        double x1[2], x2[2], y1[2], y2[2];
+        memcpy(x1, fs->sec[s][0], sizeof(x1)), memcpy(x2, fs->sec[s][1], sizeof(x2));
+        memcpy(y1, fs->sec[s][2], sizeof(y1)), memcpy(y2, fs->sec[s][3], sizeof(y2));
+        for (size_t t = 0; t < len; ++t) {
+            for (int c = 0; c < 2; ++c) {
+                double in = x[t][c];
+                double y  = a2 * y2[c] + b0 * in + b1 * x1[c] + b2 * x2[c] + a1 * y1[c];
+                x2[c] = x1[c], x1[c] = in, y2[c] = y1[c], y1[c] = y;
+                x[t][c] = y;
+            }
+        }
+        memcpy(fs->sec[s][0], x1, sizeof(x1)), memcpy(fs->sec[s][1], x2, sizeof(x2));
+        memcpy(fs->sec[s][2], y1, sizeof(y1)), memcpy(fs->sec[s][3], y2, sizeof(y2));
     }
 
-    return signal_length_samples;
+    for (size_t t = 0; t < len; ++t)
+        buf_i[t] = x[t][0], buf_q[t] = x[t][1];
 }
 
-void iq_render_defaults(iq_render_t *spec)
+/// Disturb with a higher order filter, the noise stages are the kernels without filter.
+static void render_disturb_long(ctx_t *ctx, size_t len)
 {
-    spec->sample_rate  = DEFAULT_SAMPLE_RATE;
-    spec->noise_floor  = -36;
-    spec->noise_signal = -24;
-    spec->gain         = -3;
-    spec->filter_wc    = 0.1;
-    spec->step_width   = 50;
-    spec->frame_size   = DEFAULT_BUF_LENGTH;
+    if (ctx->noise_signal != 0.0)
+        render_disturb_kernels[render_kernel_index(1, 0, 0)](ctx, len);
+    render_filter_long(ctx, len);
+    if (ctx->noise_floor != 0.0)
+        render_disturb_kernels[render_kernel_index(0, 0, 1)](ctx, len);
 }
 
-static void iq_render_init(ctx_t *ctx, iq_render_t *spec)
+static void pack_out(ctx_t *ctx, double const *buf_i, double const *buf_q, size_t len)
 {
-    if (spec->sample_rate == 0.0)
-        spec->sample_rate = DEFAULT_SAMPLE_RATE;
-
-    if (spec->frame_size == 0)
-        spec->frame_size = DEFAULT_BUF_LENGTH;
-
-    if (spec->sample_format < FORMAT_CU4 || spec->sample_format > FORMAT_CF64) {
-        fprintf(stderr, "Bad sample format (%d).\n",
-                spec->sample_format);
-        exit(1);
+    if (ctx->stats_on) {
+        ctx->stats.samples += len;
+        ctx->stats.clipped += clip_count(buf_i, buf_q, len);
     }
-
-    if (spec->full_scale == 0.0)
-        spec->full_scale = scale_defaults[spec->sample_format];
-    // fprintf(stderr, "Full scale is %.1f.\n", spec->full_scale);
-
-    size_t unit = sample_format_length(spec->sample_format);
-    if (spec->frame_size % unit != 0) {
-        fprintf(stderr, "Adjusting frame size from %zu to %zu bytes.\n",
-                spec->frame_size, spec->frame_size - spec->frame_size % unit);
-        spec->frame_size -= spec->frame_size % unit;
+    while (len) {
+        size_t room = (ctx->frame_size - ctx->frame_len) / ctx->sample_size;
+        size_t n = len < room ? len : room;
+        ctx->signal_out(ctx->frame.u8 + ctx->frame_len, buf_i, buf_q, n, ctx->full_scale);
+        ctx->frame_len += n * ctx->sample_size;
+        buf_i += n;
+        buf_q += n;
+        len -= n;
+        signal_out_maybe_flush(ctx);
     }
+}
 
-    ctx->sample_rate   = spec->sample_rate;
-    ctx->noise_floor   = noise_pp_level(spec->noise_floor);
-    ctx->noise_signal  = noise_pp_level(spec->noise_signal);
-    ctx->gain          = sine_pk_level(spec->gain);
-    ctx->sample_format = spec->sample_format;
-    ctx->full_scale    = spec->full_scale;
-    ctx->frame_size    = spec->frame_size;
-    ctx->signal_out    = format_out[ctx->sample_format];
+static void render_interp(ctx_t *ctx, size_t len);
 
-    ctx->g_db = -40;
-    ctx->g_hz = 0;
-    ctx->phi  = 0;
+void render_pack(ctx_t *ctx, size_t len)
+{
+    if (ctx->discard)
+        return;
 
-    init_db_lut();
-    nco_init();
-    init_step(ctx, spec->step_width);
-    init_filter(ctx, spec->filter_wc);
+    if (ctx->interp > 1)
+        render_interp(ctx, len);
+    else
+        pack_out(ctx, ctx->buf_i, ctx->buf_q, len);
 }
 
-static size_t iq_render(ctx_t *ctx, tone_t *tones)
+// block stages in single precision
+
+void render_rampf(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
 {
-    size_t signal_length_us = 0;
+    float *buf_i = ctx->fbuf_i;
+    float *buf_q = ctx->fbuf_q;
+    float gain   = (float)ctx->gain;
+    float g_attf = (float)g_att;
+    float n_attf = (float)n_att;
+
+    // ramp in and out
+    size_t t = 0;
+    for (; t < len && t0 + t < ctx->step_len; ++t) {
+        float att = ctx->step_outf[t0 + t] * g_attf + ctx->step_inf[t0 + t] * n_attf;
+        buf_i[t] = buf_i[t] * gain * att;
+        buf_q[t] = buf_q[t] * gain * att;
+    }
+    // steady
+    for (; t < len; ++t) {
+        buf_i[t] = buf_i[t] * gain * n_attf;
+        buf_q[t] = buf_q[t] * gain * n_attf;
+    }
+}
 
-    for (tone_t *tone = tones; (tone->us || tone->hz) && !abort_render; ++tone) {
-        if (tone->db < -24) {
-            add_sine(ctx, ctx->g_hz, (size_t)tone->us, tone->db, tone->ph);
+/// Oscillator for samples [t0, t0 + len) of the current tone in single precision.
+void osc_blockf(ctx_t *ctx, size_t t0, size_t len)
+{
+    int interp = ctx->osc_outf != nco_blockf_lut;
+    for (size_t t = 0, n; t < len; t += n) {
+        int ramp;
+        n = ramp_run(ctx, t0 + t, len - t, &ramp);
+        if (!ramp) {
+            ctx->phi = ctx->osc_outf(ctx->phi, ctx->d_phi, n, ctx->fbuf_i + t, ctx->fbuf_q + t);
+            continue;
         }
-        else {
-            add_sine(ctx, tone->hz, (size_t)tone->us, tone->db, tone->ph);
+        uint32_t base = ctx->phi - tone_phase(ctx, t0 + t);
+        for (size_t u = t; u < t + n; ++u) {
+            uint32_t phi = base + tone_phase(ctx, t0 + u);
+            if (interp) {
+                uint32_t pc = phi + 0x40000000; // quarter turn
+                float fc = (pc & 0xfffff) * (1.0f / 1048576.0f);
+                float fs = (phi & 0xfffff) * (1.0f / 1048576.0f);
+                ctx->fbuf_i[u] = nco_interp_lutf[pc >> 20] + fc * (nco_interp_lutf[(pc >> 20) + 1] - nco_interp_lutf[pc >> 20]);
+                ctx->fbuf_q[u] = nco_interp_lutf[phi >> 20] + fs * (nco_interp_lutf[(phi >> 20) + 1] - nco_interp_lutf[phi >> 20]);
+            }
+            else {
+                unsigned int i = ((phi + (1 << 21)) >> 22) & 0x3ff; // round
+                ctx->fbuf_i[u] = nco_sin_lutf[(i + 256) & 0x3ff];
+                ctx->fbuf_q[u] = nco_sin_lutf[i];
+            }
         }
-        signal_length_us += (size_t)tone->us;
+        ctx->phi = base + tone_phase(ctx, t0 + t + n);
     }
-
-    return signal_length_us;
 }
 
-int iq_render_file(char *outpath, iq_render_t *spec, tone_t *tones)
+static void render_oscf(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
 {
-    ctx_t ctx = {0};
-    ctx.fd    = -1;
-
-    iq_render_init(&ctx, spec);
-
-    if (!outpath || !*outpath || !strcmp(outpath, "-"))
-        ctx.fd = fileno(stdout);
-    else
-        ctx.fd = open(outpath, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    osc_blockf(ctx, t0, len);
+    render_rampf(ctx, t0, len, g_att, n_att);
+}
 
-    ctx.frame.u8 = malloc(ctx.frame_size);
-    if (!ctx.frame.u8) {
-        fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx.frame_size);
-        exit(1);
+void render_noisef(ctx_t *ctx, size_t len)
+{
+    if (ctx->noise_mode == NOISE_GAUSSIAN) {
+        // the gaussian generator stays in double, rounded after
+        render_noise(ctx, len);
+        for (size_t t = 0; t < len; ++t) {
+            ctx->fnoise_si[t] = (float)ctx->noise_si[t];
+            ctx->fnoise_sq[t] = (float)ctx->noise_sq[t];
+            ctx->fnoise_fi[t] = (float)ctx->noise_fi[t];
+            ctx->fnoise_fq[t] = (float)ctx->noise_fq[t];
+        }
     }
+    else {
+        noise_uniform_blockf(ctx->noise_key, ctx->smp_pos, len,
+                ctx->fnoise_si, ctx->fnoise_sq, ctx->fnoise_fi, ctx->fnoise_fq);
+    }
+}
 
-    clock_t start = clock();
-
-    size_t signal_length_us = iq_render(&ctx, tones);
-    signal_out_flush(&ctx);
+static inline void render_disturbf_kernel(ctx_t *ctx, size_t len, int noise_s, int filter, int noise_f)
+{
+    float *buf_i       = ctx->fbuf_i;
+    float *buf_q       = ctx->fbuf_q;
+    float noise_signal = (float)ctx->noise_signal;
+    float noise_floor  = (float)ctx->noise_floor;
+
+    // filter state in registers
+    filter_state_t *fs = &ctx->filter_state;
+    float a1 = fs->af[1], a2 = fs->af[2];
+    float b0 = fs->bf[0], b1 = fs->bf[1], b2 = fs->bf[2];
+    float xi0 = fs->xif[0], xi1 = fs->xif[1], yi0 = fs->yif[0], yi1 = fs->yif[1];
+    float xq0 = fs->xqf[0], xq1 = fs->xqf[1], yq0 = fs->yqf[0], yq1 = fs->yqf[1];
+
+    for (size_t t = 0; t < len; ++t) {
+        float i = buf_i[t];
+        float q = buf_q[t];
 
-    clock_t stop = clock();
-    double elapsed = (double)(stop - start) * 1000.0 / CLOCKS_PER_SEC;
-    printf("Time elapsed %g ms, signal lenght %g ms, speed %gx\n", elapsed, signal_length_us / 1000.0, signal_length_us / 1000.0 / elapsed);
+        // disturb
+        if (noise_s) {
+            i += ctx->fnoise_si[t] * noise_signal;
+            q += ctx->fnoise_sq[t] * noise_signal;
+        }
 
-    free(ctx.frame.u8);
-    if (ctx.fd != fileno(stdout))
-        close(ctx.fd);
+        // band limit, only the last term waits on the previous output
+        if (filter) {
+            float yi = a2 * yi1 + b0 * i + b1 * xi0 + b2 * xi1 + a1 * yi0;
+            float yq = a2 * yq1 + b0 * q + b1 * xq0 + b2 * xq1 + a1 * yq0;
+            xi1 = xi0, xi0 = i, yi1 = yi0, yi0 = yi;
+            xq1 = xq0, xq0 = q, yq1 = yq0, yq0 = yq;
+            i = yi;
+            q = yq;
+        }
 
-    return 0;
-}
+        // disturb
+        if (noise_f) {
+            i += ctx->fnoise_fi[t] * noise_floor;
+            q += ctx->fnoise_fq[t] * noise_floor;
+        }
 
-int iq_render_buf(iq_render_t *spec, tone_t *tones, void **out_buf, size_t *out_len)
-{
-    ctx_t ctx = {0};
-    ctx.fd    = -1;
+        buf_i[t] = i;
+        buf_q[t] = q;
+    }
 
-    iq_render_init(&ctx, spec);
+    fs->xif[0] = xi0, fs->xif[1] = xi1, fs->yif[0] = yi0, fs->yif[1] = yi1;
+    fs->xqf[0] = xq0, fs->xqf[1] = xq1, fs->yqf[0] = yq0, fs->yqf[1] = yq1;
+}
 
-    size_t smp = iq_render_length_smp(spec, tones);
-    ctx.frame_size = smp * sample_format_length(ctx.sample_format);
+RENDER_KERNELS(render_disturbf_kernel)
 
-    if (!ctx.frame_size) {
-        fprintf(stderr, "Warning: no samples to render.\n");
-        return 0;
+/// Higher order band limit in single precision.
+static void render_filter_longf(ctx_t *ctx, size_t len)
+{
+    filter_state_t *fs = &ctx->filter_state;
+    float *buf_i       = ctx->fbuf_i;
+    float *buf_q       = ctx->fbuf_q;
+
+    if (ctx->fir_len) {
+        size_t hist  = ctx->fir_len - 1;
+        float(*x)[2] = ctx->filter_iqf;
+        memcpy(x, fs->firf, hist * sizeof(*x));
+        for (size_t t = 0; t < len; ++t)
+            x[hist + t][0] = buf_i[t], x[hist + t][1] = buf_q[t];
+
+        float const *h = ctx->fir_hf;
+        for (size_t t = 0; t < len; ++t) {
+            float acc[2] = {0.0f, 0.0f};
+            float(*xt)[2] = &x[hist + t];
+            for (size_t k = 0; k <= hist; ++k)
+                for (int c = 0; c < 2; ++c)
+                    acc[c] += h[k] * xt[-(ptrdiff_t)k][c];
+            buf_i[t] = acc[0];
+            buf_q[t] = acc[1];
+        }
+        memcpy(fs->firf, x + len, hist * sizeof(*x));
+        return;
     }
 
-    ctx.frame.u8 = malloc(ctx.frame_size);
-    if (!ctx.frame.u8) {
-        fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx.frame_size);
-        exit(1);
+    float(*x)[2] = ctx->filter_iqf;
+    for (size_t t = 0; t < len; ++t)
+        x[t][0] = buf_i[t], x[t][1] = buf_q[t];
+
+    for (size_t s = 0; s < ctx->sections; ++s) {
+        float a1 = ctx->sec_af[s][1], a2 = ctx->sec_af[s][2];
+        float b0 = ctx->sec_bf[s][0], b1 = ctx->sec_bf[s][1], b2 = ctx->sec_bf[s][2];
+        float x1[2], x2[2], y1[2], y2[2];
+        memcpy(x1, fs->secf[s][0], sizeof(x1)), memcpy(x2, fs->secf[s][1], sizeof(x2));
+        memcpy(y1, fs->secf[s][2], sizeof(y1)), memcpy(y2, fs->secf[s][3], sizeof(y2));
+        for (size_t t = 0; t < len; ++t) {
+            for (int c = 0; c < 2; ++c) {
+                float in = x[t][c];
+                float y  = a2 * y2[c] + b0 * in + b1 * x1[c] + b2 * x2[c] + a1 * y1[c];
+                x2[c] = x1[c], x1[c] = in, y2[c] = y1[c], y1[c] = y;
+                x[t][c] = y;
+            }
+        }
+        memcpy(fs->secf[s][0], x1, sizeof(x1)), memcpy(fs->secf[s][1], x2, sizeof(x2));
+        memcpy(fs->secf[s][2], y1, sizeof(y1)), memcpy(fs->secf[s][3], y2, sizeof(y2));
     }
 
-    ctx.frame_size += 1; // this way we never try to flush
-
-    clock_t start = clock();
+    for (size_t t = 0; t < len; ++t)
+        buf_i[t] = x[t][0], buf_q[t] = x[t][1];
+}
 
-    size_t signal_length_us = iq_render(&ctx, tones);
+/// Disturb with a higher order filter in single precision.
+static void render_disturb_longf(ctx_t *ctx, size_t len)
+{
+    if (ctx->noise_signal != 0.0)
+        render_disturbf_kernels[render_kernel_index(1, 0, 0)](ctx, len);
+    render_filter_longf(ctx, len);
+    if (ctx->noise_floor != 0.0)
+        render_disturbf_kernels[render_kernel_index(0, 0, 1)](ctx, len);
+}
 
-    clock_t stop = clock();
-    double elapsed = (double)(stop - start) * 1000.0 / CLOCKS_PER_SEC;
-    printf("Time elapsed %g ms, signal lenght %g ms, speed %gx\n", elapsed, signal_length_us / 1000.0, signal_length_us / 1000.0 / elapsed);
+static void pack_outf(ctx_t *ctx, float const *buf_i, float const *buf_q, size_t len)
+{
+    if (ctx->stats_on) {
+        ctx->stats.samples += len;
+        ctx->stats.clipped += clip_countf(buf_i, buf_q, len);
+    }
+    while (len) {
+        size_t room = (ctx->frame_size - ctx->frame_len) / ctx->sample_size;
+        size_t n = len < room ? len : room;
+        ctx->signal_outf(ctx->frame.u8 + ctx->frame_len, buf_i, buf_q, n, (float)ctx->full_scale);
+        ctx->frame_len += n * ctx->sample_size;
+        buf_i += n;
+        buf_q += n;
+        len -= n;
+        signal_out_maybe_flush(ctx);
+    }
+}
+
+static void render_interpf(ctx_t *ctx, size_t len);
+
+void render_packf(ctx_t *ctx, size_t len)
+{
+    if (ctx->discard)
+        return;
+
+    if (ctx->interp > 1)
+        render_interpf(ctx, len);
+    else
+        pack_outf(ctx, ctx->fbuf_i, ctx->fbuf_q, len);
+}
+
+// block stages in fixed point, Q15 with 32 bit products, 64 bit only for the filter and pack
+
+void render_rampq(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
+{
+    int32_t *buf_i = ctx->qbuf_i;
+    int32_t *buf_q = ctx->qbuf_q;
+    int32_t g_amp  = level_q15(ctx->gain * g_att);
+    int32_t n_amp  = level_q15(ctx->gain * n_att);
+
+    // ramp in and out
+    size_t t = 0;
+    for (; t < len && t0 + t < ctx->step_len; ++t) {
+        int32_t amp = (ctx->step_outq[t0 + t] * g_amp + ctx->step_inq[t0 + t] * n_amp) >> 15;
+        buf_i[t] = (buf_i[t] * amp) >> 15;
+        buf_q[t] = (buf_q[t] * amp) >> 15;
+    }
+    // steady
+    for (; t < len; ++t) {
+        buf_i[t] = (buf_i[t] * n_amp) >> 15;
+        buf_q[t] = (buf_q[t] * n_amp) >> 15;
+    }
+}
+
+/// Oscillator for samples [t0, t0 + len) of the current tone in fixed point.
+void osc_blockq(ctx_t *ctx, size_t t0, size_t len)
+{
+    for (size_t t = 0, n; t < len; t += n) {
+        int ramp;
+        n = ramp_run(ctx, t0 + t, len - t, &ramp);
+        if (!ramp) {
+            ctx->phi = nco_blockq_lut(ctx->phi, ctx->d_phi, n, ctx->qbuf_i + t, ctx->qbuf_q + t);
+            continue;
+        }
+        uint32_t base = ctx->phi - tone_phase(ctx, t0 + t);
+        for (size_t u = t; u < t + n; ++u) {
+            uint32_t phi   = base + tone_phase(ctx, t0 + u);
+            unsigned int i = ((phi + (1 << 21)) >> 22) & 0x3ff; // round
+            ctx->qbuf_i[u] = nco_sin_lutq[(i + 256) & 0x3ff];
+            ctx->qbuf_q[u] = nco_sin_lutq[i];
+        }
+        ctx->phi = base + tone_phase(ctx, t0 + t + n);
+    }
+}
+
+static void render_oscq(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att)
+{
+    osc_blockq(ctx, t0, len);
+    render_rampq(ctx, t0, len, g_att, n_att);
+}
+
+void render_noiseq(ctx_t *ctx, size_t len)
+{
+    // the top 16 bits of the uniform noise, i.e. -0.5 to 0.5 as Q16
+    uint64_t key = ctx->noise_key;
+    uint64_t pos = ctx->smp_pos;
+    for (size_t t = 0; t < len; ++t) {
+        uint64_t a = noise_hash(key, 2 * (pos + t));
+        uint64_t b = noise_hash(key, 2 * (pos + t) + 1);
+        ctx->qnoise_si[t] = (int32_t)(uint32_t)a >> 16;
+        ctx->qnoise_sq[t] = (int32_t)(uint32_t)(a >> 32) >> 16;
+        ctx->qnoise_fi[t] = (int32_t)(uint32_t)b >> 16;
+        ctx->qnoise_fq[t] = (int32_t)(uint32_t)(b >> 32) >> 16;
+    }
+}
+
+static inline void render_disturbq_kernel(ctx_t *ctx, size_t len, int noise_s, int filter, int noise_f)
+{
+    int32_t *buf_i       = ctx->qbuf_i;
+    int32_t *buf_q       = ctx->qbuf_q;
+    int32_t noise_signal = ctx->noise_signalq;
+    int32_t noise_floor  = ctx->noise_floorq;
+
+    // filter state in registers
+    filter_state_t *fs = &ctx->filter_state;
+    int64_t a1 = fs->aq[1], a2 = fs->aq[2];
+    int64_t b0 = fs->bq[0], b1 = fs->bq[1], b2 = fs->bq[2];
+    int32_t xi0 = fs->xiq[0], xi1 = fs->xiq[1], yi0 = fs->yiq[0], yi1 = fs->yiq[1];
+    int32_t xq0 = fs->xqq[0], xq1 = fs->xqq[1], yq0 = fs->yqq[0], yq1 = fs->yqq[1];
+
+    for (size_t t = 0; t < len; ++t) {
+        int32_t i = buf_i[t];
+        int32_t q = buf_q[t];
+
+        // disturb
+        if (noise_s) {
+            i += (ctx->qnoise_si[t] * noise_signal) >> 16;
+            q += (ctx->qnoise_sq[t] * noise_signal) >> 16;
+        }
+
+        // band limit
+        if (filter) {
+            int32_t yi = (int32_t)((a2 * yi1 + ((b0 * i + b1 * xi0 + b2 * xi1) << FILTER_FRACQ) + a1 * yi0 + (1 << 27)) >> 28);
+            int32_t yq = (int32_t)((a2 * yq1 + ((b0 * q + b1 * xq0 + b2 * xq1) << FILTER_FRACQ) + a1 * yq0 + (1 << 27)) >> 28);
+            xi1 = xi0, xi0 = i, yi1 = yi0, yi0 = yi;
+            xq1 = xq0, xq0 = q, yq1 = yq0, yq0 = yq;
+            i = (yi + (1 << (FILTER_FRACQ - 1))) >> FILTER_FRACQ;
+            q = (yq + (1 << (FILTER_FRACQ - 1))) >> FILTER_FRACQ;
+        }
+
+        // disturb
+        if (noise_f) {
+            i += (ctx->qnoise_fi[t] * noise_floor) >> 16;
+            q += (ctx->qnoise_fq[t] * noise_floor) >> 16;
+        }
+
+        buf_i[t] = i;
+        buf_q[t] = q;
+    }
+
+    fs->xiq[0] = xi0, fs->xiq[1] = xi1, fs->yiq[0] = yi0, fs->yiq[1] = yi1;
+    fs->xqq[0] = xq0, fs->xqq[1] = xq1, fs->yqq[0] = yq0, fs->yqq[1] = yq1;
+}
+
+RENDER_KERNELS(render_disturbq_kernel)
+
+void render_packq(ctx_t *ctx, size_t len)
+{
+    int32_t const *buf_i = ctx->qbuf_i;
+    int32_t const *buf_q = ctx->qbuf_q;
+
+    if (ctx->discard)
+        return;
+
+    if (ctx->stats_on) {
+        ctx->stats.samples += len;
+        ctx->stats.clipped += clip_countq(buf_i, buf_q, len);
+    }
+    while (len) {
+        size_t room = (ctx->frame_size - ctx->frame_len) / ctx->sample_size;
+        size_t n = len < room ? len : room;
+        ctx->signal_outq(ctx->frame.u8 + ctx->frame_len, buf_i, buf_q, n, ctx->full_scaleq);
+        ctx->frame_len += n * ctx->sample_size;
+        buf_i += n;
+        buf_q += n;
+        len -= n;
+        signal_out_maybe_flush(ctx);
+    }
+}
+
+// interpolation
+
+/// Design the polyphase interpolator, a Blackman windowed sinc with the cutoff at half the render rate.
+/// Phase 0 has the single tap 1.0, every interp-th output is the input sample.
+/// Zero taps are skipped when interpolating.
+static void init_interp(ctx_t *ctx, unsigned interp)
+{
+    ctx->interp = interp > 1 ? interp : 1;
+    if (ctx->interp == 1)
+        return;
+
+    size_t n   = ctx->interp;
+    size_t len = INTERP_TAPS * n;
+    ctx->interp_h   = calloc(len, sizeof(*ctx->interp_h));
+    ctx->interp_hf  = calloc(len, sizeof(*ctx->interp_hf));
+    ctx->interp_xi  = calloc(INTERP_TAPS - 1 + RENDER_CHUNK, sizeof(*ctx->interp_xi));
+    ctx->interp_xq  = calloc(INTERP_TAPS - 1 + RENDER_CHUNK, sizeof(*ctx->interp_xq));
+    ctx->interp_xif = calloc(INTERP_TAPS - 1 + RENDER_CHUNK, sizeof(*ctx->interp_xif));
+    ctx->interp_xqf = calloc(INTERP_TAPS - 1 + RENDER_CHUNK, sizeof(*ctx->interp_xqf));
+    ctx->interp_yi  = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_yi));
+    ctx->interp_yq  = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_yq));
+    ctx->interp_yif = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_yif));
+    ctx->interp_yqf = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_yqf));
+    ctx->interp_zi  = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_zi));
+    ctx->interp_zq  = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_zq));
+    ctx->interp_zif = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_zif));
+    ctx->interp_zqf = malloc(RENDER_CHUNK * n * sizeof(*ctx->interp_zqf));
+    if (!ctx->interp_h || !ctx->interp_hf || !ctx->interp_xi || !ctx->interp_xq || !ctx->interp_xif || !ctx->interp_xqf
+            || !ctx->interp_yi || !ctx->interp_yq || !ctx->interp_yif || !ctx->interp_yqf
+            || !ctx->interp_zi || !ctx->interp_zq || !ctx->interp_zif || !ctx->interp_zqf) {
+        fprintf(stderr, "Failed to allocate interpolator.\n");
+        exit(1);
+    }
+
+    // the prototype has 2 * INTERP_HALF * n + 1 taps, centered
+    size_t center = INTERP_HALF * n;
+    for (size_t k = 0; k < INTERP_TAPS; ++k) {
+        for (size_t p = 0; p < n; ++p) {
+            size_t j = p + k * n;
+            if (j > 2 * center || (p == 0 && j != center))
+                continue; // the sinc is zero at the input samples
+            double x = ((double)j - (double)center) / (double)n;
+            double h = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double w = 0.42 - 0.5 * cos(M_PI * j / center) + 0.08 * cos(2.0 * M_PI * j / center);
+            ctx->interp_h[k * n + p]  = h * w;
+            ctx->interp_hf[k * n + p] = (float)(h * w);
+        }
+    }
+    ctx->interp_skip = center;
+    ctx->interp_left = SIZE_MAX;
+}
+
+static void interp_free(ctx_t *ctx)
+{
+    free(ctx->interp_h);
+    free(ctx->interp_hf);
+    free(ctx->interp_xi);
+    free(ctx->interp_xq);
+    free(ctx->interp_xif);
+    free(ctx->interp_xqf);
+    free(ctx->interp_yi);
+    free(ctx->interp_yq);
+    free(ctx->interp_yif);
+    free(ctx->interp_yqf);
+    free(ctx->interp_zi);
+    free(ctx->interp_zq);
+    free(ctx->interp_zif);
+    free(ctx->interp_zqf);
+}
+
+/// Take the outputs of out interpolated samples, the delay is dropped first and the output ends at interp_left.
+/// Returns the outputs to write, after skip outputs.
+static size_t interp_take(ctx_t *ctx, size_t out, size_t *skip)
+{
+    *skip = ctx->interp_skip < out ? ctx->interp_skip : out;
+    ctx->interp_skip -= *skip;
+    out -= *skip;
+    if (out > ctx->interp_left)
+        out = ctx->interp_left;
+    ctx->interp_left -= out;
+    return out;
+}
+
+/// Interpolate len render samples to the output, the first outputs are dropped for the delay.
+/// Each phase is a multiply-add over the block, which vectorizes, then the phases are interleaved.
+static void render_interp(ctx_t *ctx, size_t len)
+{
+    size_t n  = ctx->interp;
+    double *xi = ctx->interp_xi;
+    double *xq = ctx->interp_xq;
+    double *yi = ctx->interp_yi;
+    double *yq = ctx->interp_yq;
+
+    memcpy(xi + INTERP_TAPS - 1, ctx->buf_i, len * sizeof(*xi));
+    memcpy(xq + INTERP_TAPS - 1, ctx->buf_q, len * sizeof(*xq));
+
+    for (size_t p = 0; p < n; ++p) {
+        double *zi = ctx->interp_zi + p * RENDER_CHUNK;
+        double *zq = ctx->interp_zq + p * RENDER_CHUNK;
+        for (size_t t = 0; t < len; ++t)
+            zi[t] = zq[t] = 0.0;
+        for (size_t k = 0; k < INTERP_TAPS; ++k) {
+            double h = ctx->interp_h[k * n + p];
+            if (h == 0.0)
+                continue;
+            double const *ai = xi + INTERP_TAPS - 1 - k;
+            double const *aq = xq + INTERP_TAPS - 1 - k;
+            for (size_t t = 0; t < len; ++t) {
+                zi[t] += h * ai[t];
+                zq[t] += h * aq[t];
+            }
+        }
+        for (size_t t = 0; t < len; ++t) {
+            yi[t * n + p] = zi[t];
+            yq[t * n + p] = zq[t];
+        }
+    }
+
+    memmove(xi, xi + len, (INTERP_TAPS - 1) * sizeof(*xi));
+    memmove(xq, xq + len, (INTERP_TAPS - 1) * sizeof(*xq));
+
+    size_t skip;
+    size_t out = interp_take(ctx, len * n, &skip);
+    pack_out(ctx, yi + skip, yq + skip, out);
+}
+
+/// Interpolate len render samples to the output in single precision.
+static void render_interpf(ctx_t *ctx, size_t len)
+{
+    size_t n  = ctx->interp;
+    float *xi = ctx->interp_xif;
+    float *xq = ctx->interp_xqf;
+    float *yi = ctx->interp_yif;
+    float *yq = ctx->interp_yqf;
+
+    memcpy(xi + INTERP_TAPS - 1, ctx->fbuf_i, len * sizeof(*xi));
+    memcpy(xq + INTERP_TAPS - 1, ctx->fbuf_q, len * sizeof(*xq));
+
+    for (size_t p = 0; p < n; ++p) {
+        float *zi = ctx->interp_zif + p * RENDER_CHUNK;
+        float *zq = ctx->interp_zqf + p * RENDER_CHUNK;
+        for (size_t t = 0; t < len; ++t)
+            zi[t] = zq[t] = 0.0f;
+        for (size_t k = 0; k < INTERP_TAPS; ++k) {
+            float h = ctx->interp_hf[k * n + p];
+            if (h == 0.0f)
+                continue;
+            float const *ai = xi + INTERP_TAPS - 1 - k;
+            float const *aq = xq + INTERP_TAPS - 1 - k;
+            for (size_t t = 0; t < len; ++t) {
+                zi[t] += h * ai[t];
+                zq[t] += h * aq[t];
+            }
+        }
+        for (size_t t = 0; t < len; ++t) {
+            yi[t * n + p] = zi[t];
+            yq[t * n + p] = zq[t];
+        }
+    }
+
+    memmove(xi, xi + len, (INTERP_TAPS - 1) * sizeof(*xi));
+    memmove(xq, xq + len, (INTERP_TAPS - 1) * sizeof(*xq));
+
+    size_t skip;
+    size_t out = interp_take(ctx, len * n, &skip);
+    pack_outf(ctx, yi + skip, yq + skip, out);
+}
+
+/// Check if the interpolator history is all zero, i.e. zero input gives zero output.
+static int interp_idle(ctx_t *ctx)
+{
+    for (size_t k = 0; k < INTERP_TAPS - 1; ++k)
+        if (ctx->interp_xi[k] != 0.0 || ctx->interp_xq[k] != 0.0 || ctx->interp_xif[k] != 0.0f || ctx->interp_xqf[k] != 0.0f)
+            return 0;
+    return 1;
+}
+
+/// Feed zeros for the interpolator delay, the output then has interp samples for each render sample.
+static void interp_flush(ctx_t *ctx)
+{
+    if (ctx->interp == 1)
+        return;
+
+    if (ctx->precision == PRECISION_FLOAT) {
+        memset(ctx->fbuf_i, 0, INTERP_HALF * sizeof(*ctx->fbuf_i));
+        memset(ctx->fbuf_q, 0, INTERP_HALF * sizeof(*ctx->fbuf_q));
+        render_interpf(ctx, INTERP_HALF);
+    }
+    else {
+        memset(ctx->buf_i, 0, INTERP_HALF * sizeof(*ctx->buf_i));
+        memset(ctx->buf_q, 0, INTERP_HALF * sizeof(*ctx->buf_q));
+        render_interp(ctx, INTERP_HALF);
+    }
+}
+
+// silence
+
+static int lanes_below(double const *v, size_t n, double level)
+{
+    for (size_t k = 0; k < n; ++k)
+        if (fabs(v[k]) > level)
+            return 0;
+    return 1;
+}
+
+static int lanes_belowf(float const *v, size_t n, float level)
+{
+    for (size_t k = 0; k < n; ++k)
+        if (fabsf(v[k]) > level)
+            return 0;
+    return 1;
+}
+
+/// Check if the filter output stays below the silence level, then clear the state.
+int filter_settled(ctx_t *ctx)
+{
+    filter_state_t *fs = &ctx->filter_state;
+
+    if (!ctx->filter_on)
+        return 1;
+
+    if (ctx->precision == PRECISION_FIXED) {
+        int32_t level = ctx->silence_levelq;
+        for (int k = 0; k < 2; ++k)
+            if (abs(fs->xiq[k]) > level || abs(fs->yiq[k]) > level << FILTER_FRACQ || abs(fs->xqq[k]) > level || abs(fs->yqq[k]) > level << FILTER_FRACQ)
+                return 0;
+        memset(fs->xiq, 0, sizeof(fs->xiq)), memset(fs->yiq, 0, sizeof(fs->yiq));
+        memset(fs->xqq, 0, sizeof(fs->xqq)), memset(fs->yqq, 0, sizeof(fs->yqq));
+    }
+    else if (ctx->precision == PRECISION_FLOAT) {
+        float level = (float)ctx->silence_level;
+        for (int k = 0; k < 2; ++k)
+            if (fabsf(fs->xif[k]) > level || fabsf(fs->yif[k]) > level || fabsf(fs->xqf[k]) > level || fabsf(fs->yqf[k]) > level)
+                return 0;
+        if (ctx->filter_long && (!lanes_belowf(&fs->secf[0][0][0], ctx->sections * 8, level)
+                || !lanes_belowf(&fs->firf[0][0], ctx->fir_len ? (ctx->fir_len - 1) * 2 : 0, level)))
+            return 0;
+        memset(fs->xif, 0, sizeof(fs->xif)), memset(fs->yif, 0, sizeof(fs->yif));
+        memset(fs->xqf, 0, sizeof(fs->xqf)), memset(fs->yqf, 0, sizeof(fs->yqf));
+        memset(fs->secf, 0, sizeof(fs->secf)), memset(fs->firf, 0, sizeof(fs->firf));
+    }
+    else {
+        double level = ctx->silence_level;
+        for (int k = 0; k < 2; ++k)
+            if (fabs(fs->xi[k]) > level || fabs(fs->yi[k]) > level || fabs(fs->xq[k]) > level || fabs(fs->yq[k]) > level)
+                return 0;
+        if (ctx->filter_long && (!lanes_below(&fs->sec[0][0][0], ctx->sections * 8, level)
+                || !lanes_below(&fs->fir[0][0], ctx->fir_len ? (ctx->fir_len - 1) * 2 : 0, level)))
+            return 0;
+        memset(fs->xi, 0, sizeof(fs->xi)), memset(fs->yi, 0, sizeof(fs->yi));
+        memset(fs->xq, 0, sizeof(fs->xq)), memset(fs->yq, 0, sizeof(fs->yq));
+        memset(fs->sec, 0, sizeof(fs->sec)), memset(fs->fir, 0, sizeof(fs->fir));
+    }
+    return 1;
+}
+
+/// Check if samples [t, t + RENDER_CHUNK) of the current tone render as zero codes.
+int tone_silent(ctx_t *ctx, size_t t)
+{
+    return !ctx->noise_on
+            && ctx->n_att == 0.0
+            && (ctx->g_att == 0.0 || t >= ctx->step_len)
+            && filter_settled(ctx);
+}
+
+/// Output len zero codes and advance the oscillator, without rendering.
+void render_zero(ctx_t *ctx, size_t len)
+{
+    // silence follows silence, there is no frequency ramp
+    ctx->phi += (uint32_t)len * ctx->d_phi;
+
+    if (ctx->discard)
+        return;
+
+    if (ctx->interp > 1) {
+        if (!interp_idle(ctx)) {
+            // the interpolator rings out
+            memset(ctx->buf_i, 0, len * sizeof(*ctx->buf_i)), memset(ctx->buf_q, 0, len * sizeof(*ctx->buf_q));
+            memset(ctx->fbuf_i, 0, len * sizeof(*ctx->fbuf_i)), memset(ctx->fbuf_q, 0, len * sizeof(*ctx->fbuf_q));
+            if (ctx->precision == PRECISION_FLOAT)
+                render_interpf(ctx, len);
+            else
+                render_interp(ctx, len);
+            return;
+        }
+        size_t skip;
+        len = interp_take(ctx, len * ctx->interp, &skip);
+    }
+    if (ctx->stats_on) {
+        ctx->stats.samples += len;
+        ctx->stats.silent += len;
+    }
+
+    if (ctx->sparse) {
+        // the pending output goes before the hole
+        if (ctx->frame_len)
+            signal_out_flush(ctx);
+        ctx->hole += len * ctx->sample_size;
+#ifndef _WIN32
+        if (ctx->map)
+            signal_out_advance(ctx); // the window moves past the hole
+#endif
+        return;
+    }
+
+    while (len) {
+        size_t room = (ctx->frame_size - ctx->frame_len) / ctx->sample_size;
+        size_t n = len < room ? len : room;
+        if (n > RENDER_CHUNK)
+            n = RENDER_CHUNK;
+        memcpy(ctx->frame.u8 + ctx->frame_len, ctx->zero_block, n * ctx->sample_size);
+        ctx->frame_len += n * ctx->sample_size;
+        len -= n;
+        signal_out_maybe_flush(ctx);
+    }
+}
+
+static void init_zero_block(ctx_t *ctx)
+{
+    if (ctx->precision == PRECISION_FIXED) {
+        memset(ctx->qbuf_i, 0, sizeof(ctx->qbuf_i));
+        ctx->signal_outq(ctx->zero_block, ctx->qbuf_i, ctx->qbuf_i, RENDER_CHUNK, ctx->full_scaleq);
+    }
+    else if (ctx->precision == PRECISION_FLOAT) {
+        memset(ctx->fbuf_i, 0, sizeof(ctx->fbuf_i));
+        ctx->signal_outf(ctx->zero_block, ctx->fbuf_i, ctx->fbuf_i, RENDER_CHUNK, (float)ctx->full_scale);
+    }
+    else {
+        memset(ctx->buf_i, 0, sizeof(ctx->buf_i));
+        ctx->signal_out(ctx->zero_block, ctx->buf_i, ctx->buf_i, RENDER_CHUNK, ctx->full_scale);
+    }
+
+    // signed formats allow a quarter LSB, unsigned formats round at zero and need the exact zero like float formats
+    switch (ctx->sample_format) {
+    case FORMAT_CS4:
+    case FORMAT_CS8:
+    case FORMAT_CS12:
+    case FORMAT_CS16:
+    case FORMAT_CS32:
+    case FORMAT_CS64:
+        ctx->silence_level = 0.25 / ctx->full_scale;
+        // the fixed point filter can stay in a limit cycle of +/-1, i.e. 1 LSB of CS16
+        ctx->silence_levelq = (int32_t)(ctx->silence_level * 32768.0);
+        if (ctx->silence_levelq < 1)
+            ctx->silence_levelq = 1;
+        break;
+    case FORMAT_CF64:
+        ctx->silence_level  = 0.0;
+        ctx->silence_levelq = 0;
+        break;
+    default:
+        // a double residue below the smallest float subnormal packs as zero, the float state needs the exact zero
+        ctx->silence_level  = 0x1p-152;
+        ctx->silence_levelq = 0;
+        break;
+    }
+}
+
+static int filter_history_equal(filter_state_t const *a, filter_state_t const *b)
+{
+    return !memcmp(a->xi, b->xi, sizeof(a->xi)) && !memcmp(a->yi, b->yi, sizeof(a->yi))
+            && !memcmp(a->xq, b->xq, sizeof(a->xq)) && !memcmp(a->yq, b->yq, sizeof(a->yq))
+            && !memcmp(a->xif, b->xif, sizeof(a->xif)) && !memcmp(a->yif, b->yif, sizeof(a->yif))
+            && !memcmp(a->xqf, b->xqf, sizeof(a->xqf)) && !memcmp(a->yqf, b->yqf, sizeof(a->yqf))
+            && !memcmp(a->xiq, b->xiq, sizeof(a->xiq)) && !memcmp(a->yiq, b->yiq, sizeof(a->yiq))
+            && !memcmp(a->xqq, b->xqq, sizeof(a->xqq)) && !memcmp(a->yqq, b->yqq, sizeof(a->yqq))
+            && !memcmp(a->sec, b->sec, sizeof(a->sec)) && !memcmp(a->secf, b->secf, sizeof(a->secf))
+            && !memcmp(a->fir, b->fir, sizeof(a->fir)) && !memcmp(a->firf, b->firf, sizeof(a->firf));
+}
+
+/// Copy the recursive filter history to a mark.
+static void filter_mark_set(filter_mark_t *m, filter_state_t const *fs)
+{
+    memset(m, 0, sizeof(*m));
+    memcpy(m->yi, fs->yi, sizeof(m->yi));
+    memcpy(m->xi, fs->xi, sizeof(m->xi));
+    memcpy(m->yq, fs->yq, sizeof(m->yq));
+    memcpy(m->xq, fs->xq, sizeof(m->xq));
+    memcpy(m->yif, fs->yif, sizeof(m->yif));
+    memcpy(m->xif, fs->xif, sizeof(m->xif));
+    memcpy(m->yqf, fs->yqf, sizeof(m->yqf));
+    memcpy(m->xqf, fs->xqf, sizeof(m->xqf));
+    memcpy(m->yiq, fs->yiq, sizeof(m->yiq));
+    memcpy(m->xiq, fs->xiq, sizeof(m->xiq));
+    memcpy(m->yqq, fs->yqq, sizeof(m->yqq));
+    memcpy(m->xqq, fs->xqq, sizeof(m->xqq));
+    memcpy(m->sec, fs->sec, sizeof(m->sec));
+    memcpy(m->secf, fs->secf, sizeof(m->secf));
+}
+
+/// Record the filter history every few blocks, or check it, returns 1 once settled.
+static int filter_log_block(ctx_t *ctx)
+{
+    filter_log_t *log = ctx->filter_log;
+
+    if (++log->blocks < FILTER_LOG_BLOCKS)
+        return log->settled;
+    log->blocks = 0;
+
+    filter_mark_t mark;
+    filter_mark_set(&mark, &ctx->filter_state);
+    if (log->check) {
+        if (log->pos < log->len && !memcmp(&mark, &log->mark[log->pos++], sizeof(mark)))
+            log->settled = 1;
+        return log->settled;
+    }
+
+    if (log->len == log->size) {
+        log->size = log->size ? log->size * 2 : 64;
+        log->mark = realloc(log->mark, log->size * sizeof(*log->mark));
+        if (!log->mark) {
+            fprintf(stderr, "Failed to allocate filter log.\n");
+            exit(1);
+        }
+    }
+    log->mark[log->len++] = mark;
+    return 0;
+}
+
+// wave cache
+
+/// Find the entry for a block of the current tone, NULL if the cache is off.
+/// The entry matches if len is set, otherwise the block is to be rendered into it.
+static wave_entry_t *wave_cache_entry(ctx_t *ctx, size_t t0, size_t len)
+{
+    if (!ctx->wave_cache_len)
+        return NULL;
+
+    if (!ctx->wave_cache) {
+        ctx->wave_cache = calloc(ctx->wave_cache_len, sizeof(*ctx->wave_cache));
+        uint8_t *buf    = malloc(ctx->wave_cache_len * 2 * RENDER_CHUNK * sizeof(double));
+        if (!ctx->wave_cache || !buf) {
+            fprintf(stderr, "Failed to allocate wave cache, rendering without.\n");
+            free(ctx->wave_cache);
+            free(buf);
+            ctx->wave_cache     = NULL;
+            ctx->wave_cache_len = 0;
+            return NULL;
+        }
+        for (size_t k = 0; k < ctx->wave_cache_len; ++k)
+            ctx->wave_cache[k].buf = buf + k * 2 * RENDER_CHUNK * sizeof(double);
+    }
+
+    // past the ramp and clear of the frequency steps all blocks of a tone are the same
+    double g_att = ctx->g_att;
+    uint64_t edge_key = ctx->edge_key;
+    if (t0 >= ctx->step_len && t0 >= ctx->ramp_head && t0 + len <= ctx->ramp_tail) {
+        t0       = ctx->step_len;
+        g_att    = ctx->n_att;
+        edge_key = 0;
+    }
+    else if (t0 >= ctx->step_len) {
+        g_att = ctx->n_att;
+    }
+
+    uint64_t g_bits, n_bits;
+    memcpy(&g_bits, &g_att, sizeof(g_bits));
+    memcpy(&n_bits, &ctx->n_att, sizeof(n_bits));
+    uint64_t h = noise_hash(g_bits ^ (n_bits << 1) ^ edge_key, ((uint64_t)ctx->d_phi << 32) ^ ((uint64_t)t0 << 16) ^ len);
+    wave_entry_t *e = &ctx->wave_cache[h % ctx->wave_cache_len];
+
+    if (e->len != len || e->t0 != t0 || e->d_phi != ctx->d_phi || e->edge_key != edge_key
+            || e->g_att != g_att || e->n_att != ctx->n_att) {
+        // replace the entry
+        e->len      = 0;
+        e->t0       = t0;
+        e->d_phi    = ctx->d_phi;
+        e->edge_key = edge_key;
+        e->g_att = g_att;
+        e->n_att = ctx->n_att;
+    }
+    return e;
+}
+
+static void wave_cache_free(ctx_t *ctx)
+{
+    if (ctx->wave_cache)
+        free(ctx->wave_cache[0].buf);
+    free(ctx->wave_cache);
+    ctx->wave_cache = NULL;
+}
+
+/// Oscillator and ramp stage from the cache, the block is rotated from the cached phase.
+/// At the cached phase this is a copy, otherwise the same within the oscillator accuracy.
+void render_wave(ctx_t *ctx, size_t t0, size_t len)
+{
+    wave_entry_t *e = wave_cache_entry(ctx, t0, len);
+    if (!e) {
+        render_osc(ctx, t0, len, ctx->g_att, ctx->n_att);
+        return;
+    }
+
+    double *wave_i = e->buf;
+    double *wave_q = wave_i + RENDER_CHUNK;
+    if (!e->len) {
+        e->phi = ctx->phi;
+        render_osc(ctx, t0, len, ctx->g_att, ctx->n_att);
+        memcpy(wave_i, ctx->buf_i, len * sizeof(*wave_i));
+        memcpy(wave_q, ctx->buf_q, len * sizeof(*wave_q));
+        e->len = len;
+        return;
+    }
+
+    uint32_t rot = ctx->phi - e->phi;
+    ctx->phi += tone_advance(ctx, t0, len);
+    if (!rot) {
+        memcpy(ctx->buf_i, wave_i, len * sizeof(*wave_i));
+        memcpy(ctx->buf_q, wave_q, len * sizeof(*wave_q));
+        return;
+    }
+    double const rad = 2.0 * M_PI / 4294967296.0;
+    double cr = cos(rad * rot);
+    double ci = sin(rad * rot);
+    for (size_t t = 0; t < len; ++t) {
+        ctx->buf_i[t] = wave_i[t] * cr - wave_q[t] * ci;
+        ctx->buf_q[t] = wave_i[t] * ci + wave_q[t] * cr;
+    }
+}
+
+/// Oscillator and ramp stage from the cache in single precision.
+static void render_wavef(ctx_t *ctx, size_t t0, size_t len)
+{
+    wave_entry_t *e = wave_cache_entry(ctx, t0, len);
+    if (!e) {
+        render_oscf(ctx, t0, len, ctx->g_att, ctx->n_att);
+        return;
+    }
+
+    float *wave_i = e->buf;
+    float *wave_q = wave_i + RENDER_CHUNK;
+    if (!e->len) {
+        e->phi = ctx->phi;
+        render_oscf(ctx, t0, len, ctx->g_att, ctx->n_att);
+        memcpy(wave_i, ctx->fbuf_i, len * sizeof(*wave_i));
+        memcpy(wave_q, ctx->fbuf_q, len * sizeof(*wave_q));
+        e->len = len;
+        return;
+    }
+
+    uint32_t rot = ctx->phi - e->phi;
+    ctx->phi += tone_advance(ctx, t0, len);
+    if (!rot) {
+        memcpy(ctx->fbuf_i, wave_i, len * sizeof(*wave_i));
+        memcpy(ctx->fbuf_q, wave_q, len * sizeof(*wave_q));
+        return;
+    }
+    double const rad = 2.0 * M_PI / 4294967296.0;
+    float cr = (float)cos(rad * rot);
+    float ci = (float)sin(rad * rot);
+    for (size_t t = 0; t < len; ++t) {
+        ctx->fbuf_i[t] = wave_i[t] * cr - wave_q[t] * ci;
+        ctx->fbuf_q[t] = wave_i[t] * ci + wave_q[t] * cr;
+    }
+}
+
+/// Output samples of a time on the us timeline, rounded, the output ends within the last render sample.
+static size_t output_smp(double sample_rate, size_t time_us)
+{
+    return (size_t)(time_us * sample_rate / 1000000.0 + 0.5);
+}
+
+/// Render sample of a tone edge at a time on the us timeline, the nearest to the edge at the output rate.
+/// The end of the last tone is rounded up, the interpolated output is cut at the output length.
+static size_t tone_edge(ctx_t const *ctx, size_t time_us, int last)
+{
+    size_t smp = output_smp(ctx->sample_rate * ctx->interp, time_us);
+    return (smp + (last ? ctx->interp - 1 : ctx->interp / 2)) / ctx->interp;
+}
+
+/// Setup a tone, the ramp starts from the previous tone.
+static void tone_begin(ctx_t *ctx, tone_t const *tone)
+{
+    // silent tones keep the frequency
+    double freq_hz = tone->db < -24 ? ctx->g_hz : tone->hz;
+    ctx->d_phi = nco_d_phase((ssize_t)freq_hz, (size_t)ctx->sample_rate);
+    // the frequency ramps from an audible tone
+    ctx->d_from = ctx->freq_step && ctx->g_db >= -24 ? nco_d_phase((ssize_t)ctx->g_hz, (size_t)ctx->sample_rate) : ctx->d_phi;
+    // uint32_t phi = nco_phase((ssize_t)freq_hz, (size_t)ctx->sample_rate, global_time_us); // absolute phase
+    // uint32_t phi = 0; // relative phase
+
+    // phase offset if requested
+    int ph = tone->ph;
+    while (ph < 0)
+        ph += 360;
+    while (ph >= 360)
+        ph -= 360;
+    if (ph) {
+        ctx->phi += 11930465 * (uint32_t)ph; // (0x100000000 / 360)
+    }
+
+    ctx->n_att = db_to_mag(tone->db);
+    ctx->g_att = db_to_mag(ctx->g_db);
+    ctx->g_db  = tone->db;
+    ctx->g_hz  = freq_hz;
+
+    // the edges are rounded on the us timeline at the output rate, the lengths don't drift
+    int last      = !tone[1].us && !tone[1].hz;
+    size_t start  = tone_edge(ctx, ctx->tone_us, 0);
+    ctx->tone_us += (size_t)tone->us;
+    ctx->tone_len = tone_edge(ctx, ctx->tone_us, last) - start;
+    tone_edges(ctx);
+}
+
+/// Render samples [t, end) of the current tone, t is a multiple of RENDER_CHUNK.
+void tone_render(ctx_t *ctx, size_t t, size_t end)
+{
+    for (; t < end; t += RENDER_CHUNK) {
+        size_t len = end - t < RENDER_CHUNK ? end - t : RENDER_CHUNK;
+        if (ctx->stats_on)
+            ctx->stats_lap = stats_now();
+
+        if (tone_silent(ctx, t)) {
+            render_zero(ctx, len);
+        }
+        else if (ctx->precision == PRECISION_FIXED) {
+            render_oscq(ctx, t, len, ctx->g_att, ctx->n_att);
+            stats_lap(ctx, &ctx->stats.osc_s);
+            if (ctx->noise_on)
+                render_noiseq(ctx, len);
+            stats_lap(ctx, &ctx->stats.noise_s);
+            ctx->disturb(ctx, len);
+            stats_lap(ctx, &ctx->stats.filter_s);
+            render_packq(ctx, len);
+        }
+        else if (ctx->precision == PRECISION_FLOAT) {
+            render_wavef(ctx, t, len);
+            stats_lap(ctx, &ctx->stats.osc_s);
+            if (ctx->noise_on)
+                render_noisef(ctx, len);
+            stats_lap(ctx, &ctx->stats.noise_s);
+            ctx->disturb(ctx, len);
+            stats_lap(ctx, &ctx->stats.filter_s);
+            render_packf(ctx, len);
+        }
+        else {
+            render_wave(ctx, t, len);
+            stats_lap(ctx, &ctx->stats.osc_s);
+            if (ctx->noise_on)
+                render_noise(ctx, len);
+            stats_lap(ctx, &ctx->stats.noise_s);
+            ctx->disturb(ctx, len);
+            stats_lap(ctx, &ctx->stats.filter_s);
+            render_pack(ctx, len);
+        }
+        stats_lap(ctx, &ctx->stats.pack_s);
+        ctx->smp_pos += len;
+        if (ctx->filter_log && filter_log_block(ctx))
+            return;
+    }
+}
+
+// render plan
+
+/// Compile the tones to a plan, the state at the start of each tone is found with prefix sums, without rendering.
+void render_plan(ctx_t *ctx, tone_t const *tones)
+{
+    uint32_t phi   = ctx->phi;
+    int g_db       = ctx->g_db;
+    double g_hz    = ctx->g_hz;
+    size_t smp_pos = ctx->smp_pos;
+    size_t tone_len = ctx->tone_len;
+    size_t tone_us  = ctx->tone_us;
+
+    size_t n = 0;
+    while (tones[n].us || tones[n].hz)
+        n++;
+    plan_tone_t *plan = malloc((n + 1) * sizeof(*plan));
+    if (!plan) {
+        fprintf(stderr, "Failed to allocate render plan.\n");
+        exit(1);
+    }
+
+    // the phase offsets first, the steps of a tone depend on the tones after it
+    for (size_t k = 0; k < n; ++k) {
+        tone_begin(ctx, &tones[k]);
+        plan[k] = (plan_tone_t){ctx->smp_pos, ctx->tone_len, ctx->phi, ctx->d_phi, ctx->d_from, ctx->g_att, ctx->n_att, ctx->g_db, ctx->g_hz};
+        ctx->smp_pos += ctx->tone_len;
+    }
+    plan[n] = (plan_tone_t){ctx->smp_pos, 0, ctx->phi, 0, 0, 0.0, 0.0, ctx->g_db, ctx->g_hz};
+
+    free(ctx->plan);
+    ctx->plan     = plan;
+    ctx->plan_len = n;
+
+    uint32_t advance = 0;
+    for (size_t k = 0; k < n; ++k) {
+        plan[k].phi += advance;
+        plan_begin(ctx, k);
+        advance += tone_phase(ctx, ctx->tone_len);
+    }
+    plan[n].phi += advance;
+
+    ctx->phi     = phi;
+    ctx->g_db    = g_db;
+    ctx->g_hz    = g_hz;
+    ctx->smp_pos = smp_pos;
+    ctx->tone_len = tone_len;
+    ctx->tone_us  = tone_us;
+}
+
+/// Setup a planned tone, the same state as tone_begin() after the tones before.
+/// The gaussian steps of the tone changes reaching into tone k.
+/// A step is between two audible tones, the frequency of silent tones is kept.
+static void plan_edges(ctx_t *ctx, size_t k)
+{
+    plan_tone_t const *plan = ctx->plan;
+    size_t start = plan[k].start;
+    size_t end   = start + plan[k].len;
+    size_t half  = (size_t)-ctx->freq_lo;
+
+    ctx->edges = 0;
+    // steps of this tone and before, up to the first one ending before the tone
+    for (size_t j = k; j > 0 && plan[j].start + half > start; --j)
+        if (plan[j - 1].g_db >= -24 && plan[j].g_db >= -24)
+            edges_add(ctx, (ptrdiff_t)plan[j].start - (ptrdiff_t)half - (ptrdiff_t)start, plan[j - 1].d_phi, plan[j].d_phi);
+    // steps of the following tones beginning in this tone
+    for (size_t j = k + 1; j < ctx->plan_len && plan[j].start < end + half; ++j)
+        if (plan[j - 1].g_db >= -24 && plan[j].g_db >= -24)
+            edges_add(ctx, (ptrdiff_t)plan[j].start - (ptrdiff_t)half - (ptrdiff_t)start, plan[j - 1].d_phi, plan[j].d_phi);
+    edges_end(ctx);
+}
+
+void plan_begin(ctx_t *ctx, size_t k)
+{
+    plan_tone_t const *tone = &ctx->plan[k];
+    ctx->smp_pos  = tone->start;
+    ctx->tone_len = tone->len;
+    ctx->phi      = tone->phi;
+    ctx->d_phi    = tone->d_phi;
+    ctx->d_from   = tone->d_from;
+    ctx->g_att    = tone->g_att;
+    ctx->n_att    = tone->n_att;
+    ctx->g_db     = tone->g_db;
+    ctx->g_hz     = tone->g_hz;
+    if (ctx->gauss_c)
+        plan_edges(ctx, k);
+    else
+        tone_edges(ctx);
+}
+
+static inline size_t cut_pos(render_cut_t const *cut)
+{
+    return cut->smp_pos + cut->t;
+}
+
+/// Find the cut at or just before a sample position, the end of the plan at most.
+static render_cut_t plan_cut(ctx_t *ctx, size_t pos)
+{
+    plan_tone_t const *plan = ctx->plan;
+
+    // the first tone ending after pos
+    size_t lo = 0;
+    size_t hi = ctx->plan_len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (plan[mid].start + plan[mid].len > pos)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    render_cut_t cut = {lo, 0, plan[lo].start};
+    if (lo < ctx->plan_len && pos > plan[lo].start)
+        cut.t = (pos - plan[lo].start) / RENDER_CHUNK * RENDER_CHUNK;
+    return cut;
+}
+
+/// Restore the render state at a cut, the filter state is kept.
+void render_seek(ctx_t *ctx, render_cut_t const *cut)
+{
+    plan_begin(ctx, cut->tone);
+    ctx->phi += tone_phase(ctx, cut->t);
+    ctx->smp_pos += cut->t;
+}
+
+/// Render from a cut to a cut, the state needs to be at the first cut.
+static void render_span(ctx_t *ctx, render_cut_t const *from, render_cut_t const *to)
+{
+    filter_log_t *log = ctx->filter_log;
+    size_t t = from->t;
+    for (size_t k = from->tone; k <= to->tone && !render_aborted(ctx) && !(log && log->settled); ++k, t = 0) {
+        if (k != from->tone)
+            plan_begin(ctx, k);
+        tone_render(ctx, t, k == to->tone ? to->t : ctx->tone_len);
+    }
+}
+
+/// A segment rendered by a thread.
+typedef struct render_job {
+    ctx_t *ctx;
+    uint8_t *out_buf;  ///< output buffer or NULL to write to the file
+    off_t out_off;     ///< file offset of the first sample
+    render_cut_t warm; ///< start of the filter warm-up
+    render_cut_t from;
+    render_cut_t to;
+    filter_state_t start_state; ///< filter state after the warm-up
+    filter_state_t end_state;
+    filter_log_t filter_log;
+    pthread_t thread;
+} render_job_t;
+
+static void render_job_output(render_job_t *job)
+{
+    ctx_t *ctx     = job->ctx;
+    size_t offset  = cut_pos(&job->from) * ctx->sample_size;
+    ctx->frame_len = 0;
+    ctx->hole      = 0;
+    if (job->out_buf) {
+        // never flush, the frame is the output
+        ctx->frame.u8   = job->out_buf + offset;
+        ctx->frame_size = (cut_pos(&job->to) - cut_pos(&job->from)) * ctx->sample_size + 1;
+    }
+    else {
+        ctx->out_off = job->out_off + (off_t)offset;
+    }
+}
+
+static void *render_job_thread(void *arg)
+{
+    render_job_t *job = arg;
+    ctx_t *ctx        = job->ctx;
+
+    render_seek(ctx, &job->warm);
+    ctx->discard = 1;
+    render_span(ctx, &job->warm, &job->from);
+    ctx->discard     = 0;
+    job->start_state = ctx->filter_state;
+
+    render_job_output(job);
+    // a FIR is exact after the warm-up, only a recursive filter needs the log
+    ctx->filter_log = ctx->fir_len ? NULL : &job->filter_log;
+    render_span(ctx, &job->from, &job->to);
+    signal_out_flush(ctx);
+    job->end_state = ctx->filter_state;
+
+    return NULL;
+}
+
+/// Render segments on threads, the output is identical to a serial render.
+/// Each segment warms up the filter from earlier samples and is checked against
+/// the final filter state of the segment before. On a mismatch the segment is
+/// rendered again from the exact state, until the filter history meets a mark
+/// of the first render.
+static int iq_render_threads(ctx_t *ctx, tone_t *tones, size_t total, uint8_t *out_buf, off_t out_off)
+{
+    size_t n = ctx->interp > 1 ? 1 : ctx->threads;
+    if (n > total / MIN_SEGMENT)
+        n = total / MIN_SEGMENT;
+    if (n < 2)
+        return -1;
+
+    render_cut_t *cuts  = calloc(n + 1, sizeof(*cuts));
+    render_cut_t *warms = calloc(n + 1, sizeof(*warms));
+    render_job_t *jobs  = calloc(n, sizeof(*jobs));
+    if (!cuts || !warms || !jobs) {
+        fprintf(stderr, "Failed to allocate render jobs.\n");
+        exit(1);
+    }
+
+    render_plan(ctx, tones);
+    for (size_t k = 0; k <= n; ++k) {
+        cuts[k]  = plan_cut(ctx, k < n ? total / n * k : total);
+        size_t p = cut_pos(&cuts[k]);
+        warms[k] = plan_cut(ctx, p > ctx->filter_warmup ? p - ctx->filter_warmup : 0);
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        render_job_t *job = &jobs[k];
+        job->ctx = malloc(sizeof(ctx_t));
+        if (!job->ctx) {
+            fprintf(stderr, "Failed to allocate render context.\n");
+            exit(1);
+        }
+        *job->ctx = *ctx;
+        job->ctx->wave_cache = NULL; // each thread fills its own
+        memset(&job->ctx->stats, 0, sizeof(job->ctx->stats));
+        if (!out_buf) {
+            job->ctx->frame.u8 = malloc(ctx->frame_size);
+            if (!job->ctx->frame.u8) {
+                fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx->frame_size);
+                exit(1);
+            }
+        }
+        job->out_buf = out_buf;
+        job->out_off = out_off;
+        job->warm    = warms[k];
+        job->from    = cuts[k];
+        job->to      = cuts[k + 1];
+        if (pthread_create(&job->thread, NULL, render_job_thread, job)) {
+            fprintf(stderr, "Failed to start render thread.\n");
+            exit(1);
+        }
+    }
+    for (size_t k = 0; k < n; ++k) {
+        pthread_join(jobs[k].thread, NULL);
+        ctx->out_failed |= jobs[k].ctx->out_failed;
+    }
+
+    // segments with an unsettled filter are rendered again, from the exact state
+    for (size_t k = 1; k < n && !render_aborted(ctx); ++k) {
+        render_job_t *job = &jobs[k];
+        filter_state_t const *state = &jobs[k - 1].end_state;
+        if (filter_history_equal(&job->start_state, state))
+            continue;
+        render_seek(job->ctx, &job->from);
+        job->ctx->filter_state = *state;
+        job->ctx->sparse       = 0; // overwrite all of the first output
+        job->filter_log.check  = 1;
+        job->filter_log.blocks = 0;
+        render_job_output(job);
+        render_span(job->ctx, &job->from, &job->to);
+        signal_out_flush(job->ctx);
+        ctx->out_failed |= job->ctx->out_failed;
+        if (!job->filter_log.settled)
+            job->end_state = job->ctx->filter_state;
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        stats_add(&ctx->stats, &jobs[k].ctx->stats);
+        free(jobs[k].filter_log.mark);
+        wave_cache_free(jobs[k].ctx);
+        if (!out_buf)
+            free(jobs[k].ctx->frame.u8);
+        free(jobs[k].ctx);
+    }
+    free(jobs);
+    free(warms);
+    free(cuts);
+    free(ctx->plan);
+    ctx->plan = NULL;
+    return 0;
+}
+
+// api
+
+size_t iq_render_length_us(tone_t *tones)
+{
+    size_t signal_length_us = 0;
+
+    for (tone_t *tone = tones; tone->us || tone->hz; ++tone) {
+        signal_length_us += (size_t)tone->us;
+    }
+
+    return signal_length_us;
+}
+
+/// Filter ratio at the render rate. The Butterworth is prewarped to the analog cutoff of the filter
+/// at the output rate, i.e. the same analog prototype, the FIR keeps the cutoff frequency.
+static double render_filter_wc(iq_render_t const *spec, unsigned interp)
+{
+    if (interp == 1 || spec->filter_wc >= 0.5)
+        return spec->filter_wc;
+    if (spec->filter_type == FILTER_FIR)
+        return spec->filter_wc * interp;
+    return atan(interp * tan(M_PI * spec->filter_wc)) / M_PI;
+}
+
+/// Resolve the interpolation factor for a spec, the render rate is sample_rate / factor.
+static unsigned iq_render_interp(iq_render_t *spec, tone_t *tones)
+{
+    if (spec->sample_rate == 0.0)
+        spec->sample_rate = DEFAULT_SAMPLE_RATE;
+    double sample_rate = spec->sample_rate;
 
+    // the band is the highest tone or the filter cutoff, it needs to stay below INTERP_BAND of the render rate
+    double band = spec->filter_wc < 0.5 ? spec->filter_wc * sample_rate : 0.0;
+    for (tone_t *tone = tones; tone->us || tone->hz; ++tone)
+        if (abs(tone->hz) > band)
+            band = abs(tone->hz);
+    unsigned limit = band > 0.0 ? (unsigned)(INTERP_BAND * sample_rate / band) : MAX_INTERP;
+    if (limit > MAX_INTERP)
+        limit = MAX_INTERP;
+    if (limit < 1)
+        limit = 1;
+
+    unsigned interp = spec->interp > MAX_INTERP ? MAX_INTERP : spec->interp > 0 ? (unsigned)spec->interp : 1;
+    if (spec->interp == INTERP_AUTO) {
+        interp = limit;
+    }
+    else if (interp > limit) {
+        fprintf(stderr, "Reducing the interpolation factor from %u to %u, the signal band needs the render rate.\n", interp, limit);
+        interp       = limit;
+        spec->interp = (int)limit; // say it once
+    }
+    // the render rate needs to be whole
+    while (interp > 1 && fmod(sample_rate, interp) != 0.0)
+        interp--;
+    return interp ? interp : 1;
+}
+
+size_t iq_render_length_smp(iq_render_t *spec, tone_t *tones)
+{
+    double sample_rate = spec->sample_rate != 0.0 ? spec->sample_rate : DEFAULT_SAMPLE_RATE;
+    return output_smp(sample_rate, iq_render_length_us(tones));
+}
+
+void iq_render_defaults(iq_render_t *spec)
+{
+    spec->sample_rate   = DEFAULT_SAMPLE_RATE;
+    spec->noise_floor   = -36;
+    spec->noise_signal  = -24;
+    spec->gain          = -3;
+    spec->filter_wc     = 0.1;
+    spec->step_width    = 50;
+    spec->freq_step     = 1;
+    spec->frame_size    = DEFAULT_BUF_LENGTH;
+    spec->rand_seed     = 1;
+    spec->precision     = PRECISION_AUTO;
+    spec->write_buffers = 4;
+}
+
+int iq_render_stats_json(char const *path, iq_render_stats_t const *stats)
+{
+    FILE *fp = !path || !*path || !strcmp(path, "-") ? stdout : fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Failed to open stats output \"%s\" (%s).\n", path, strerror(errno));
+        return -1;
+    }
+
+    double const smp = (double)stats->samples;
+    struct {
+        char const *name;
+        double s;
+    } const stages[] = {
+            {"osc", stats->osc_s},
+            {"noise", stats->noise_s},
+            {"filter", stats->filter_s},
+            {"pack", stats->pack_s},
+            {"write", stats->write_s},
+    };
+
+    // rates are output samples per second of the time spent
+    fprintf(fp, "{\"samples\": %zu, \"silent\": %zu, \"clipped\": %zu, \"isa\": \"%s\",\n",
+            stats->samples, stats->silent, stats->clipped, sample_pack_isa());
+    fprintf(fp, " \"wall_s\": %.6f, \"cpu_s\": %.6f, \"msps\": %.3f,\n \"stages\": {",
+            stats->wall_s, stats->cpu_s, stats->wall_s > 0.0 ? smp / stats->wall_s / 1e6 : 0.0);
+    for (size_t k = 0; k < sizeof(stages) / sizeof(*stages); ++k) {
+        fprintf(fp, "%s\n  \"%s\": {\"s\": %.6f, \"msps\": %.3f}", k ? "," : "",
+                stages[k].name, stages[k].s, stages[k].s > 0.0 ? smp / stages[k].s / 1e6 : 0.0);
+    }
+    fprintf(fp, "}}\n");
+
+    if (fp == stdout) {
+        fflush(fp);
+        return 0;
+    }
+    return fclose(fp) ? -1 : 0;
+}
+
+/// Reset the render state to the start of a signal.
+static void render_reset(ctx_t *ctx)
+{
+    filter_state_t *fs = &ctx->filter_state;
+
+    ctx->smp_pos = 0;
+    ctx->tone_us = 0;
+    ctx->g_db    = -40;
+    ctx->g_hz    = 0;
+    ctx->phi     = 0;
+
+    memset(fs->xi, 0, sizeof(fs->xi)), memset(fs->yi, 0, sizeof(fs->yi));
+    memset(fs->xq, 0, sizeof(fs->xq)), memset(fs->yq, 0, sizeof(fs->yq));
+    memset(fs->xif, 0, sizeof(fs->xif)), memset(fs->yif, 0, sizeof(fs->yif));
+    memset(fs->xqf, 0, sizeof(fs->xqf)), memset(fs->yqf, 0, sizeof(fs->yqf));
+    memset(fs->xiq, 0, sizeof(fs->xiq)), memset(fs->yiq, 0, sizeof(fs->yiq));
+    memset(fs->xqq, 0, sizeof(fs->xqq)), memset(fs->yqq, 0, sizeof(fs->yqq));
+    memset(fs->sec, 0, sizeof(fs->sec)), memset(fs->secf, 0, sizeof(fs->secf));
+    memset(fs->fir, 0, sizeof(fs->fir)), memset(fs->firf, 0, sizeof(fs->firf));
+}
+
+/// Select the disturb kernel, noise and filter don't change while rendering.
+static void init_kernels(ctx_t *ctx)
+{
+    if (ctx->precision == PRECISION_FIXED) {
+        int noise_s   = ctx->noise_signalq != 0;
+        int noise_f   = ctx->noise_floorq != 0;
+        ctx->noise_on = noise_s || noise_f;
+        ctx->disturb  = render_disturbq_kernels[render_kernel_index(noise_s, ctx->filter_on, noise_f)];
+    }
+    else {
+        int noise_s   = ctx->noise_signal != 0.0;
+        int noise_f   = ctx->noise_floor != 0.0;
+        ctx->noise_on = noise_s || noise_f;
+        if (ctx->filter_long)
+            ctx->disturb = ctx->precision == PRECISION_FLOAT ? render_disturb_longf : render_disturb_long;
+        else if (ctx->precision == PRECISION_FLOAT)
+            ctx->disturb = render_disturbf_kernels[render_kernel_index(noise_s, ctx->filter_on, noise_f)];
+        else
+            ctx->disturb = render_disturb_kernels[render_kernel_index(noise_s, ctx->filter_on, noise_f)];
+    }
+}
+
+/// Resolve the pipeline precision for a spec.
+static enum render_precision iq_render_precision(iq_render_t *spec, unsigned interp)
+{
+    enum sample_format format = spec->sample_format;
+
+    // fixed point supports the basic features only
+    int fixed_ok = (format == FORMAT_CS8 || format == FORMAT_CS16)
+            && interp == 1
+            && ((spec->filter_type == FILTER_BUTTERWORTH && spec->filter_order <= 2) || spec->filter_wc >= 0.5)
+            && spec->noise_mode == NOISE_UNIFORM
+            && spec->nco_engine == NCO_LUT
+            && sine_pk_level(spec->gain) <= 1.0 && spec->full_scale < 32768.0;
+    // float lacks the resolution for the wide formats
+    int float_ok = !(format >= FORMAT_CU32 && format <= FORMAT_CS64) && format != FORMAT_CF64;
+
+    switch (spec->precision) {
+    case PRECISION_AUTO:
+        return fixed_ok ? PRECISION_FIXED : PRECISION_DOUBLE;
+    case PRECISION_FIXED:
+        if (fixed_ok)
+            return PRECISION_FIXED;
+        fprintf(stderr, "Fixed point needs CS8 or CS16 output, uniform noise, the LUT oscillator, a 2nd order filter and no interpolation, using double.\n");
+        return PRECISION_DOUBLE;
+    case PRECISION_FLOAT:
+        if (float_ok)
+            return PRECISION_FLOAT;
+        fprintf(stderr, "Keeping double precision for %s output.\n", sample_format_str(format));
+        return PRECISION_DOUBLE;
+    default:
+        return PRECISION_DOUBLE;
+    }
+}
+
+/// Setup a context for a spec, rendering at sample_rate / interp.
+void iq_render_init(ctx_t *ctx, iq_render_t *spec, unsigned interp)
+{
+    if (spec->sample_rate == 0.0)
+        spec->sample_rate = DEFAULT_SAMPLE_RATE;
+
+    if (spec->frame_size == 0)
+        spec->frame_size = DEFAULT_BUF_LENGTH;
+
+    if (spec->sample_format < FORMAT_CU4 || spec->sample_format > FORMAT_CF64) {
+        fprintf(stderr, "Bad sample format (%d).\n",
+                spec->sample_format);
+        exit(1);
+    }
+
+    if (spec->full_scale == 0.0)
+        spec->full_scale = scale_defaults[spec->sample_format];
+    // fprintf(stderr, "Full scale is %.1f.\n", spec->full_scale);
+
+    size_t unit = sample_format_length(spec->sample_format);
+    if (spec->frame_size % unit != 0) {
+        fprintf(stderr, "Adjusting frame size from %zu to %zu bytes.\n",
+                spec->frame_size, spec->frame_size - spec->frame_size % unit);
+        spec->frame_size -= spec->frame_size % unit;
+    }
+
+    if (spec->noise_ref == NOISE_REF_ESN0 && spec->symbol_rate <= 0.0) {
+        fprintf(stderr, "Es/N0 noise level needs a symbol rate.\n");
+        exit(1);
+    }
+
+    ctx->sample_rate   = spec->sample_rate / interp;
+    ctx->gain          = sine_pk_level(spec->gain);
+    ctx->noise_mode    = spec->noise_mode;
+    ctx->noise_signal  = noise_mode_scale(spec->noise_mode, noise_pp_level(spec->noise_signal));
+    if (spec->noise_ref == NOISE_REF_SNR)
+        ctx->noise_floor = noise_mode_scale(spec->noise_mode, sqrt(12.0) * noise_snr_rms(spec->noise_floor, ctx->gain));
+    else if (spec->noise_ref == NOISE_REF_ESN0)
+        // noise is full band of the render rate, Es/N0 = SNR * sample_rate / symbol_rate
+        ctx->noise_floor = noise_mode_scale(spec->noise_mode, sqrt(12.0) * noise_snr_rms(spec->noise_floor
+                + 10.0 * log10(spec->symbol_rate / ctx->sample_rate), ctx->gain));
+    else
+        ctx->noise_floor = noise_mode_scale(spec->noise_mode, noise_pp_level(spec->noise_floor));
+    ctx->sample_format = spec->sample_format;
+    ctx->full_scale    = spec->full_scale;
+    ctx->frame_size    = spec->frame_size;
+    ctx->sample_size   = unit;
+    ctx->signal_out    = sample_pack_for(ctx->sample_format);
+    ctx->osc_out       = spec->nco_engine == NCO_ROTATOR ? nco_block_rotator
+                       : spec->nco_engine == NCO_LUT_INTERP ? nco_block_interp
+                       : nco_block_lut;
+    ctx->precision     = iq_render_precision(spec, interp);
+    ctx->signal_outf   = sample_packf_for(ctx->sample_format);
+    ctx->signal_outq   = sample_packq_for(ctx->sample_format);
+    ctx->osc_outf      = spec->nco_engine == NCO_ROTATOR ? nco_blockf_rotator
+                       : spec->nco_engine == NCO_LUT_INTERP ? nco_blockf_interp
+                       : nco_blockf_lut;
+
+    ctx->noise_signalq = level_q15(ctx->noise_signal);
+    ctx->noise_floorq  = level_q15(ctx->noise_floor);
+    ctx->full_scaleq   = (int32_t)lrint(spec->full_scale < 32768.0 ? spec->full_scale * 32768.0 : 0);
+
+    ctx->threads       = spec->threads;
+    ctx->flag_abort    = spec->flag_abort;
+    ctx->stats_out     = spec->stats;
+    ctx->stats_on      = spec->stats != NULL;
+    ctx->write_buffers = spec->write_buffers;
+    ctx->out_off       = -1;
+    // a replay of a LUT block is off by the phase rounding of the LUT, only the rotator replays within 1 LSB,
+    // fixed point renders the oscillator about as fast as a copy
+    ctx->wave_cache_len = spec->nco_engine == NCO_ROTATOR && ctx->precision != PRECISION_FIXED ? spec->wave_cache : 0;
+
+    ctx->noise_key = noise_key(spec->rand_seed);
+    render_reset(ctx);
+
+    init_db_lut();
+    nco_init();
+    ctx->freq_step = spec->freq_step;
+    init_step(ctx, spec->step_width, spec->step_shape);
+    init_gauss(ctx, spec->gauss_bt, spec->symbol_rate);
+    init_filter(ctx, render_filter_wc(spec, interp), spec->filter_type, spec->filter_order);
+    init_filterf(ctx);
+    init_kernels(ctx);
+    init_zero_block(ctx);
+    init_interp(ctx, interp);
+}
+
+/// Free the tables and caches of a context setup with iq_render_init().
+void render_free(ctx_t *ctx)
+{
+    wave_cache_free(ctx);
+    interp_free(ctx);
+    free(ctx->step_out); // all step tables are one allocation
+    ctx->step_out = NULL;
+    free(ctx->gauss_c);
+    ctx->gauss_c = NULL;
+}
+
+static size_t iq_render(ctx_t *ctx, tone_t *tones)
+{
+    size_t signal_length_us = 0;
+    ctx->interp_left = output_smp(ctx->sample_rate * ctx->interp, iq_render_length_us(tones));
+
+    if (ctx->gauss_c) {
+        // the gaussian steps reach into the tone before, render from the plan
+        render_plan(ctx, tones);
+        for (size_t k = 0; k < ctx->plan_len && !render_aborted(ctx); ++k) {
+            plan_begin(ctx, k);
+            tone_render(ctx, 0, ctx->tone_len);
+            signal_length_us += (size_t)tones[k].us;
+        }
+        free(ctx->plan);
+        ctx->plan = NULL;
+    }
+    for (tone_t *tone = tones; !ctx->gauss_c && (tone->us || tone->hz) && !render_aborted(ctx); ++tone) {
+        tone_begin(ctx, tone);
+        tone_render(ctx, 0, ctx->tone_len);
+        signal_length_us += (size_t)tone->us;
+    }
+    interp_flush(ctx);
+
+    return signal_length_us;
+}
+
+/// Check if the zero codes are all zero bytes, i.e. can be left as a hole in a file.
+int zero_block_is_zero(ctx_t *ctx)
+{
+    for (size_t k = 0; k < RENDER_CHUNK * ctx->sample_size; ++k)
+        if (ctx->zero_block[k])
+            return 0;
+    return 1;
+}
+
+/// Render to the output file on threads if it is seekable, otherwise serially.
+/// Zero codes are skipped in regular files, leaving holes.
+static size_t iq_render_fd(ctx_t *ctx, tone_t *tones)
+{
+    size_t signal_length_us = 0;
+#ifndef _WIN32
+    if (ctx->map) {
+        // silent pages of the mapping are never touched and stay holes
+        ctx->sparse = zero_block_is_zero(ctx);
+        if (iq_render_threads(ctx, tones, ctx->map_len / ctx->sample_size, ctx->map, 0) == 0)
+            return iq_render_length_us(tones);
+        signal_length_us = iq_render(ctx, tones);
+        signal_out_flush(ctx);
+        return signal_length_us;
+    }
+
+    struct stat st;
+    int regular = fstat(ctx->fd, &st) == 0 && S_ISREG(st.st_mode);
+    ctx->sparse = regular && !(fcntl(ctx->fd, F_GETFL) & O_APPEND) && zero_block_is_zero(ctx);
+
+    int done = 0;
+    if (ctx->threads > 1 && regular) {
+        size_t total = output_smp(ctx->sample_rate, iq_render_length_us(tones));
+        off_t off = lseek(ctx->fd, 0, SEEK_CUR);
+        if (off >= 0 && iq_render_threads(ctx, tones, total, NULL, off) == 0) {
+            lseek(ctx->fd, off + (off_t)(total * ctx->sample_size), SEEK_SET);
+            signal_length_us = iq_render_length_us(tones);
+            done = 1;
+        }
+    }
+    if (!done) {
+        uint8_t *frame = ctx->frame.u8;
+        int writer     = ctx->write_buffers > 1 && writer_open(ctx) == 0;
+        signal_length_us = iq_render(ctx, tones);
+        signal_out_flush(ctx);
+        if (writer && writer_close(ctx, frame))
+            ctx->out_failed = 1;
+    }
+
+    // a hole at the end needs the file extended
+    off_t end = lseek(ctx->fd, 0, SEEK_CUR);
+    if (ctx->sparse && end >= 0 && fstat(ctx->fd, &st) == 0 && st.st_size < end && ftruncate(ctx->fd, end)) {
+        fprintf(stderr, "Failed to extend the output file.\n");
+        ctx->out_failed = 1;
+    }
+#else
+    uint8_t *frame = ctx->frame.u8;
+    int writer     = ctx->write_buffers > 1 && writer_open(ctx) == 0;
+    signal_length_us = iq_render(ctx, tones);
+    signal_out_flush(ctx);
+    if (writer && writer_close(ctx, frame))
+        ctx->out_failed = 1;
+#endif
+    return signal_length_us;
+}
+
+int iq_render_file(char *outpath, iq_render_t *spec, tone_t *tones)
+{
+    ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        exit(1);
+    }
+    ctx->fd = -1;
+
+    if (spec->checkpoint && (!outpath || !*outpath || !strcmp(outpath, "-"))) {
+        fprintf(stderr, "Can't checkpoint to stdout, rendering without.\n");
+    }
+    else if (spec->checkpoint) {
+        iq_render_init(ctx, spec, 1);
+        ctx->wave_cache_len = 0; // replays rotate, a resume must render the same
+        ctx->frame.u8       = malloc(ctx->frame_size);
+        if (!ctx->frame.u8) {
+            fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx->frame_size);
+            exit(1);
+        }
+
+        stats_begin(ctx);
+
+        size_t signal_length_us = iq_render_checkpointed(ctx, outpath, spec, tones);
+
+        double elapsed = stats_end(ctx);
+        if (!spec->quiet)
+            printf("Time elapsed %g ms, signal length %g ms, speed %gx\n", elapsed, signal_length_us / 1000.0, signal_length_us / 1000.0 / elapsed);
+
+        free(ctx->frame.u8);
+        render_free(ctx);
+        close(ctx->fd);
+        int r = ctx->out_failed ? -1 : 0;
+        free(ctx);
+        return r;
+    }
+
+    iq_render_init(ctx, spec, iq_render_interp(spec, tones));
+
+    if (!outpath || !*outpath || !strcmp(outpath, "-"))
+        ctx->fd = fileno(stdout);
+    else
+        ctx->fd = open(outpath, O_CREAT | O_TRUNC | (spec->output_mode == OUTPUT_MMAP ? O_RDWR : O_WRONLY), 0644);
+    if (ctx->fd < 0) {
+        fprintf(stderr, "Failed to open output \"%s\" (%s).\n", outpath, strerror(errno));
+        exit(1);
+    }
+
+#ifndef _WIN32
+    if (spec->output_mode == OUTPUT_MMAP
+            && signal_out_map(ctx, iq_render_length_smp(spec, tones) * ctx->sample_size)) {
+        fprintf(stderr, "Can't map the output, writing instead.\n");
+    }
+#endif
+
+    if (!ctx->map) {
+        ctx->frame.u8 = malloc(ctx->frame_size);
+        if (!ctx->frame.u8) {
+            fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx->frame_size);
+            exit(1);
+        }
+    }
+
+    stats_begin(ctx);
+
+    size_t signal_length_us = iq_render_fd(ctx, tones);
+
+    double elapsed = stats_end(ctx);
+    if (!spec->quiet)
+        printf("Time elapsed %g ms, signal length %g ms, speed %gx\n", elapsed, signal_length_us / 1000.0, signal_length_us / 1000.0 / elapsed);
+
+#ifndef _WIN32
+    if (ctx->map)
+        signal_out_unmap(ctx);
+    else
+#endif
+        free(ctx->frame.u8);
+    render_free(ctx);
+    if (ctx->fd != fileno(stdout))
+        close(ctx->fd);
+
+    int r = ctx->out_failed ? -1 : 0;
+    free(ctx);
+    return r;
+}
+
+int iq_render_buf(iq_render_t *spec, tone_t *tones, void **out_buf, size_t *out_len)
+{
+    ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        exit(1);
+    }
+    ctx->fd = -1;
+
+    iq_render_init(ctx, spec, iq_render_interp(spec, tones));
+
+    size_t smp = iq_render_length_smp(spec, tones);
+    ctx->frame_size = smp * sample_format_length(ctx->sample_format);
+
+    if (!ctx->frame_size) {
+        fprintf(stderr, "Warning: no samples to render.\n");
+        render_free(ctx);
+        free(ctx);
+        if (out_buf)
+            *out_buf = NULL;
+        if (out_len)
+            *out_len = 0;
+        return 0;
+    }
+
+    ctx->frame.u8 = malloc(ctx->frame_size);
+    if (!ctx->frame.u8) {
+        fprintf(stderr, "Failed to allocate output buffer of %zu bytes.\n", ctx->frame_size);
+        exit(1);
+    }
+
+    ctx->frame_size += 1; // this way we never try to flush
+
+    stats_begin(ctx);
+
+    size_t signal_length_us;
+    if (iq_render_threads(ctx, tones, smp, ctx->frame.u8, 0) == 0)
+        signal_length_us = iq_render_length_us(tones);
+    else
+        signal_length_us = iq_render(ctx, tones);
+
+    double elapsed = stats_end(ctx);
+    if (!spec->quiet)
+        printf("Time elapsed %g ms, signal length %g ms, speed %gx\n", elapsed, signal_length_us / 1000.0, signal_length_us / 1000.0 / elapsed);
+
+    render_free(ctx);
     if (out_buf)
-        *out_buf = ctx.frame.u8;
+        *out_buf = ctx->frame.u8;
     else
-        free(ctx.frame.u8);
+        free(ctx->frame.u8);
     if (out_len)
-        *out_len = ctx.frame_size - 1;
+        *out_len = ctx->frame_size - 1;
+    free(ctx);
     return 0;
 }
+
+// pull api
+
+iq_render_ctx_t *iq_render_open(iq_render_t *spec, tone_t *tones)
+{
+    ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        return NULL;
+    }
+    ctx->fd = -1;
+
+    iq_render_init(ctx, spec, 1);
+    stats_begin(ctx);
+
+    ctx->stage = malloc(RENDER_CHUNK * ctx->sample_size);
+    if (!ctx->stage) {
+        fprintf(stderr, "Failed to allocate render context.\n");
+        iq_render_close(ctx);
+        return NULL;
+    }
+    render_plan(ctx, tones);
+
+    return ctx;
+}
+
+/// Sample position of the next block.
+static size_t stream_pos(ctx_t const *ctx)
+{
+    return ctx->stream_tone ? ctx->plan[ctx->stream_tone - 1].start + ctx->stream_t : 0;
+}
+
+/// Render the next block to dst, returns the number of samples, 0 at the end.
+static size_t stream_block(ctx_t *ctx, uint8_t *dst)
+{
+    while (ctx->stream_t >= ctx->tone_len) {
+        if (ctx->stream_tone >= ctx->plan_len || render_aborted(ctx))
+            return 0;
+        plan_begin(ctx, ctx->stream_tone);
+        ctx->stream_tone += 1;
+        ctx->stream_t = 0;
+    }
+
+    size_t t   = ctx->stream_t;
+    size_t end = ctx->tone_len - t < RENDER_CHUNK ? ctx->tone_len : t + RENDER_CHUNK;
+
+    ctx->frame.u8   = dst;
+    ctx->frame_len  = 0;
+    ctx->frame_size = (end - t) * ctx->sample_size + 1; // this way we never try to flush
+    tone_render(ctx, t, end);
+    ctx->stream_t = end;
+
+    return end - t;
+}
+
+size_t iq_render_read(iq_render_ctx_t *ctx, void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    size_t done  = 0;
+
+    while (done < len) {
+        // drain the stage first
+        if (ctx->stage_pos < ctx->stage_len) {
+            size_t n = (ctx->stage_len - ctx->stage_pos) / ctx->sample_size;
+            if (n > len - done)
+                n = len - done;
+            memcpy(out + done * ctx->sample_size, ctx->stage + ctx->stage_pos, n * ctx->sample_size);
+            ctx->stage_pos += n * ctx->sample_size;
+            done += n;
+            continue;
+        }
+
+        // whole blocks go straight to the caller
+        if (len - done >= RENDER_CHUNK) {
+            size_t n = stream_block(ctx, out + done * ctx->sample_size);
+            if (!n)
+                break;
+            done += n;
+        }
+        else {
+            size_t n = stream_block(ctx, ctx->stage);
+            if (!n)
+                break;
+            ctx->stage_len = n * ctx->sample_size;
+            ctx->stage_pos = 0;
+        }
+    }
+
+    return done;
+}
+
+void iq_render_rewind(iq_render_ctx_t *ctx)
+{
+    render_reset(ctx);
+    ctx->tone_len    = 0;
+    ctx->stream_tone = 0;
+    ctx->stream_t    = 0;
+    ctx->stage_len   = 0;
+    ctx->stage_pos   = 0;
+}
+
+size_t iq_render_length(iq_render_ctx_t *ctx)
+{
+    return ctx->plan[ctx->plan_len].start;
+}
+
+int iq_render_seek(iq_render_ctx_t *ctx, size_t pos)
+{
+    if (pos > iq_render_length(ctx))
+        return -1;
+
+    render_cut_t cut = plan_cut(ctx, pos);
+    size_t at        = cut_pos(&cut);
+
+    // warm up the filter from a cut before, or from the start, unless the stream is already in the warm-up
+    size_t from = at > ctx->filter_warmup ? at - ctx->filter_warmup : 0;
+    if (stream_pos(ctx) > at || stream_pos(ctx) < from) {
+        render_cut_t warm = plan_cut(ctx, from);
+        render_reset(ctx);
+        render_seek(ctx, &warm);
+        ctx->stream_tone = warm.tone + 1;
+        ctx->stream_t    = warm.t;
+    }
+    ctx->discard = 1;
+    while (stream_pos(ctx) < at && stream_block(ctx, ctx->stage))
+        ;
+    ctx->discard   = 0;
+    ctx->stage_len = 0;
+    ctx->stage_pos = 0;
+
+    // the cut is at a block, skip into the block
+    if (pos > at) {
+        size_t n       = stream_block(ctx, ctx->stage);
+        ctx->stage_len = n * ctx->sample_size;
+        ctx->stage_pos = (pos - at) * ctx->sample_size;
+    }
+    return 0;
+}
+
+size_t iq_render_range(iq_render_ctx_t *ctx, size_t a, size_t b, void *buf)
+{
+    if (b <= a || iq_render_seek(ctx, a))
+        return 0;
+    return iq_render_read(ctx, buf, b - a);
+}
+
+void iq_render_close(iq_render_ctx_t *ctx)
+{
+    if (!ctx)
+        return;
+    stats_end(ctx);
+    free(ctx->plan);
+    free(ctx->stage);
+    render_free(ctx);
+    free(ctx);
+}
@@ -28,6 +28,71 @@
 #define DEFAULT_BUF_LENGTH (1 * 16384)
 #define MINIMAL_BUF_LENGTH 512
 #define MAXIMAL_BUF_LENGTH (256 * 16384)
+#define INTERP_AUTO -1 ///< pick the interpolation factor from the tones and the filter
+
+/// Noise distribution.
+enum noise_mode {
+    NOISE_UNIFORM,  ///< uniform, cheap, the default
+    NOISE_GAUSSIAN, ///< gaussian (AWGN)
+};
+
+/// Reference for the noise floor level.
+enum noise_ref {
+    NOISE_REF_FS,   ///< noise_floor is dBFS or multiplier
+    NOISE_REF_SNR,  ///< noise_floor is SNR in dB relative to gain
+    NOISE_REF_ESN0, ///< noise_floor is Es/N0 in dB relative to gain, needs symbol_rate
+};
+
+/// Oscillator engine.
+enum nco_engine {
+    NCO_LUT,        ///< rounded LUT, the default
+    NCO_LUT_INTERP, ///< larger LUT with linear interpolation, cleaner spectrum
+    NCO_ROTATOR,    ///< complex rotator, cleanest spectrum, no table lookups
+};
+
+/// Render pipeline precision.
+/// Float is exact to about 1 LSB up to 16 bit formats.
+/// CU32/CS32, CU64/CS64 and CF64 always render in double.
+/// Fixed point is integer only, for CS8 and CS16 with uniform noise and the LUT oscillator.
+enum render_precision {
+    PRECISION_DOUBLE, ///< double
+    PRECISION_FLOAT,  ///< float, faster, for formats up to 16 bits and CF32
+    PRECISION_FIXED,  ///< fixed point, for hosts with a weak FPU
+    PRECISION_AUTO,   ///< fixed point if the spec allows, otherwise double, the default
+};
+
+/// Band limiting filter.
+enum filter_type {
+    FILTER_BUTTERWORTH, ///< cascaded biquads, the default
+    FILTER_FIR,         ///< linear-phase FIR, windowed sinc
+};
+
+/// Transition shape of the amplitude and frequency steps.
+enum step_shape {
+    STEP_LINEAR,   ///< linear ramp, the default
+    STEP_COSINE,   ///< raised cosine
+    STEP_GAUSSIAN, ///< gaussian edge, the narrowest spectrum
+};
+
+/// How iq_render_file() writes the output.
+enum output_mode {
+    OUTPUT_WRITE, ///< write() frames, the default, works with pipes
+    OUTPUT_MMAP,  ///< render into a mapping of the output file, regular files only
+};
+
+/// Counters of a render, the stage times are summed over the render threads.
+typedef struct iq_render_stats {
+    size_t samples;  ///< output samples
+    size_t silent;   ///< samples of silent blocks, written as zero codes or holes
+    size_t clipped;  ///< samples with I or Q beyond full scale, saturated by the integer formats
+    double wall_s;   ///< wall clock time
+    double cpu_s;    ///< CPU time of the process, all threads
+    double osc_s;    ///< oscillator and ramps
+    double noise_s;  ///< noise
+    double filter_s; ///< filter
+    double pack_s;   ///< sample format packing, interpolation and silent blocks
+    double write_s;  ///< output writes, or waits for the writer thread
+} iq_render_stats_t;
 
 typedef struct iq_render {
     double sample_rate;
@@ -35,24 +100,105 @@ typedef struct iq_render {
     double noise_signal; ///< peak-to-peak
     double gain;         ///< usually a little below 0
     double filter_wc;    ///< filter ratio
+    enum filter_type filter_type;
+    unsigned filter_order; ///< Butterworth order, even, up to 16, or FIR taps, odd, up to 127, 0 is 2 or 63
     unsigned step_width; ///< step width in us
+    enum step_shape step_shape; ///< shape of the steps
+    int freq_step;       ///< ramp the frequency between audible tones over the step, phase continuous, default 1
+    double gauss_bt;     ///< GFSK bandwidth-time product of the gaussian frequency pulse, 0 is off, needs symbol_rate
     enum sample_format sample_format;
     double full_scale; ///< full scale, useful for CS16/CS32, 0=max
     size_t frame_size; ///< default will be used if 0
+    unsigned rand_seed; ///< noise seed, the same seed gives the same noise at each sample position
+    enum noise_mode noise_mode; ///< noise distribution
+    enum noise_ref noise_ref;   ///< how noise_floor is given
+    double symbol_rate;         ///< symbols per second for NOISE_REF_ESN0 and GFSK
+    enum nco_engine nco_engine; ///< oscillator engine
+    unsigned threads;           ///< render threads, 0 or 1 renders serially
+    enum render_precision precision; ///< pipeline precision
+    enum output_mode output_mode;    ///< output method of iq_render_file()
+    unsigned write_buffers; ///< frames of frame_size queued to a writer thread, 0 or 1 writes directly
+    unsigned wave_cache;    ///< oscillator blocks cached for repeated tones, 0 is off, rotator engine only, within 1 LSB of no cache
+    int interp; ///< render at sample_rate / interp and interpolate, 0 or 1 is off, or INTERP_AUTO, file and buffer renders only, reduced to keep the band
+    char const *checkpoint; ///< file of the render state for iq_render_file(), a matching one is resumed, NULL is off
+    unsigned checkpoint_s;  ///< seconds between checkpoints, 0 is 10
+    int volatile *flag_abort; ///< the render stops when this is set, e.g. from a signal handler, NULL is never
+    iq_render_stats_t *stats; ///< counters the render adds to, NULL is off, timing each stage costs a little
+    int quiet; ///< don't print the render time and speed
 } iq_render_t;
 
-// parsing a code from string or reading in
+/// A signal of a mix, on the shared timeline of the output.
+typedef struct iq_emitter {
+    tone_t *tones;   ///< the tones, terminated by a tone of 0 us and 0 Hz
+    int hz;          ///< frequency offset added to the tones
+    size_t start_us; ///< start on the timeline
+    double level;    ///< level in dB added to the gain, e.g. -20
+} iq_emitter_t;
+
+/// A render in progress, for pulling samples on demand.
+typedef struct iq_render_ctx iq_render_ctx_t;
 
-extern int abort_render;
+// parsing a code from string or reading in
 
+/// Renders share no mutable state, any number of renders can run at once on different threads.
 void iq_render_defaults(iq_render_t *spec);
 
 size_t iq_render_length_us(tone_t *tones);
 
 size_t iq_render_length_smp(iq_render_t *spec, tone_t *tones);
 
+/// Render the tones to a file, or stdout for "-" or NULL.
+/// With a checkpoint the render state is saved at intervals and on abort, and a render
+/// of the same spec and tones resumes from it, appending to the partial output, byte-identical
+/// to a render without interruption. Checkpointed renders are serial and write directly,
+/// without interpolation or wave cache, to a regular file.
 int iq_render_file(char *outpath, iq_render_t *spec, tone_t *tones);
 
 int iq_render_buf(iq_render_t *spec, tone_t *tones, void **out_buf, size_t *out_len);
 
+/// Render the tones to count outputs in one pass, each with its own spec, e.g. noise, gain, filter and format.
+/// The oscillator and the noise are rendered once, the specs need the same sample rate, step width,
+/// oscillator engine, noise mode and seed, otherwise each output is rendered alone.
+/// Outputs are written directly, the threads, output_mode and write_buffers settings are not used.
+/// The stats of all outputs are added to the stats of the first spec.
+int iq_render_files(char **outpaths, iq_render_t *specs, size_t count, tone_t *tones);
+
+/// Render count emitters into one wideband output, e.g. a busy band of many devices.
+/// The emitters are summed, then the noise and the filter of the spec are applied once.
+/// An emitter is rendered only while it is active and not silent, idle stretches cost nothing.
+/// Renders in double precision without interpolation, the output is written directly.
+int iq_render_mix(char *outpath, iq_render_t *spec, iq_emitter_t *emitters, size_t count);
+
+/// Write the stats as a JSON object to a file, or stdout for "-", returns -1 on error.
+int iq_render_stats_json(char const *path, iq_render_stats_t const *stats);
+
+// pull api, constant memory, the first samples are ready right away
+
+/// Start rendering the tones, the tone list is not used after.
+iq_render_ctx_t *iq_render_open(iq_render_t *spec, tone_t *tones);
+
+/// Render the next len samples to buf, returns the number of samples, less than len only at the end.
+size_t iq_render_read(iq_render_ctx_t *ctx, void *buf, size_t len);
+
+/// Restart from the first sample, the output is the same again.
+void iq_render_rewind(iq_render_ctx_t *ctx);
+
+// random access, the tones are planned with prefix sums when opened
+
+/// Number of samples to render.
+size_t iq_render_length(iq_render_ctx_t *ctx);
+
+/// Continue reading at sample pos, the filter is warmed up over the samples before pos.
+/// A FIR filter is warmed up over its history, the samples are the same as from a full render.
+/// A Butterworth filter is warmed up until its state decayed, at most a million samples,
+/// the samples are then within 1 LSB of a full render, or within 1e-5 of full scale for CF32.
+/// Returns -1 if pos is past the end.
+int iq_render_seek(iq_render_ctx_t *ctx, size_t pos);
+
+/// Render samples [a, b) to buf, returns the number of samples, less than b - a only at the end.
+size_t iq_render_range(iq_render_ctx_t *ctx, size_t a, size_t b, void *buf);
+
+/// Free the render context, the stats of the spec are added to.
+void iq_render_close(iq_render_ctx_t *ctx);
+
 #endif /* INCLUDE_IQRENDER_H_ */
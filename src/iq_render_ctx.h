@@ -0,0 +1,432 @@
+/** @file
+    tx_tools - iq_render internals, the render context shared by the render, output and multi-output code.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IQRENDERCTX_H_
+#define INCLUDE_IQRENDERCTX_H_
+
+#include "iq_render.h"
+#include "sample.h"
+#include "sample_pack.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "nco.h"
+
+
+#define RENDER_CHUNK 1024 ///< samples per render block
+#define MAX_FREQ_EDGES 32 ///< frequency steps reaching into a tone
+#define MIN_SEGMENT (256 * 1024) ///< minimum samples per render thread
+#define MAX_WARMUP (1024 * 1024) ///< maximum samples to settle the filter state
+#define MAX_SECTIONS 8 ///< biquad sections, up to 16th order
+#define MAX_FIR_TAPS 127
+#define FILTER_LOG_BLOCKS 64 ///< blocks between filter marks of a render thread
+#define FILTER_FRACQ 12 ///< fraction bits of the fixed point filter outputs beyond Q15, no dead band at low cutoffs
+#define DEFAULT_FIR_TAPS 63
+#define MAX_INTERP 64 ///< maximum interpolation factor
+#define INTERP_HALF 8 ///< interpolator half length in input samples, also its delay
+#define INTERP_TAPS (2 * INTERP_HALF + 1) ///< interpolator taps per phase
+#define INTERP_BAND 0.3 ///< highest signal frequency relative to the render rate
+
+/// Filter state.
+typedef struct filter_state {
+    double a[2 + 1]; // up to 2nd order
+    double b[2 + 1]; // up to 2nd order
+    double yi[2];
+    double xi[2];
+    double yq[2];
+    double xq[2];
+    // single precision
+    float af[2 + 1];
+    float bf[2 + 1];
+    float yif[2];
+    float xif[2];
+    float yqf[2];
+    float xqf[2];
+    // fixed point, Q28 coefficients, Q15 inputs and outputs with FILTER_FRACQ more bits
+    int32_t aq[2 + 1];
+    int32_t bq[2 + 1];
+    int32_t yiq[2];
+    int32_t xiq[2];
+    int32_t yqq[2];
+    int32_t xqq[2];
+    // higher orders, I and Q as lanes
+    double sec[MAX_SECTIONS][4][2];  ///< biquad sections, x1, x2, y1, y2
+    float secf[MAX_SECTIONS][4][2];
+    double fir[MAX_FIR_TAPS - 1][2]; ///< FIR history, oldest first
+    float firf[MAX_FIR_TAPS - 1][2];
+} filter_state_t;
+
+/// The recursive filter history, a FIR history is exact after its warm-up and not kept.
+typedef struct filter_mark {
+    double yi[2];
+    double xi[2];
+    double yq[2];
+    double xq[2];
+    float yif[2];
+    float xif[2];
+    float yqf[2];
+    float xqf[2];
+    int32_t yiq[2];
+    int32_t xiq[2];
+    int32_t yqq[2];
+    int32_t xqq[2];
+    double sec[MAX_SECTIONS][4][2];
+    float secf[MAX_SECTIONS][4][2];
+} filter_mark_t;
+
+/// Filter history every FILTER_LOG_BLOCKS blocks of a render, to find where a re-render settles.
+typedef struct filter_log {
+    filter_mark_t *mark;
+    size_t len;
+    size_t size;
+    size_t pos;    ///< next mark to check
+    size_t blocks; ///< blocks since the last mark
+    int check;     ///< compare to the marks instead of recording
+    int settled;   ///< the filter history met the recorded mark
+} filter_log_t;
+
+/// A tone compiled for random access, the render state once the tone began.
+typedef struct plan_tone {
+    size_t start;   ///< first sample, the sum of the lengths before
+    size_t len;     ///< length in samples
+    uint32_t phi;   ///< phase at the first sample, with the phase offset
+    uint32_t d_phi; ///< phase increment
+    uint32_t d_from; ///< phase increment ramped from
+    double g_att;   ///< attenuation ramped from
+    double n_att;   ///< attenuation ramped to
+    int g_db;
+    double g_hz;
+} plan_tone_t;
+
+/// A frequency step reaching into the current tone.
+/// The phase increment is d_phi plus delta times the step residual, which starts at pos.
+typedef struct freq_edge {
+    ptrdiff_t pos; ///< first residual sample, relative to the tone start
+    double delta;  ///< phase increment before the step minus after
+} freq_edge_t;
+
+/// An oscillator and ramp block, keyed by everything but the phase.
+typedef struct wave_entry {
+    uint32_t d_phi;
+    uint64_t edge_key; ///< frequency steps in the block, 0 for none
+    uint32_t phi;  ///< phase the block was rendered at
+    double g_att;  ///< attenuation ramped from, the same as n_att past the ramp
+    double n_att;
+    size_t t0;     ///< samples into the tone, step_len for the steady blocks
+    size_t len;    ///< samples in the block, 0 if unused
+    void *buf;     ///< I then Q, double or float by precision
+} wave_entry_t;
+
+/// A sample position in the plan.
+typedef struct render_cut {
+    size_t tone;    ///< tone index
+    size_t t;       ///< samples into the tone, a multiple of RENDER_CHUNK
+    size_t smp_pos; ///< samples before the tone
+} render_cut_t;
+
+// render context
+
+typedef struct iq_render_ctx ctx_t;
+
+struct writer;
+
+struct iq_render_ctx {
+    double sample_rate;
+    double noise_floor;  ///< peak-to-peak (-19 dB)
+    double noise_signal; ///< peak-to-peak (-25 dB)
+    double gain;         ///< sine-peak (-0 dB)
+    enum noise_mode noise_mode;
+
+    enum sample_format sample_format;
+    double full_scale;
+    size_t frame_size;
+    size_t sample_size; ///< bytes per I/Q sample
+
+    size_t frame_len;
+    frame_t frame;
+    int fd;
+    off_t out_off; ///< offset for positioned writes, -1 writes sequentially
+    int discard;   ///< render without output, e.g. to warm up the filter
+    int out_failed; ///< an output write failed, the render stops
+    unsigned threads;
+    int volatile *flag_abort; ///< stops the render when set, or NULL
+
+    iq_render_stats_t stats;      ///< counters of this context
+    iq_render_stats_t *stats_out; ///< stats requested by the spec, or NULL
+    int stats_on;                 ///< time the stages
+    double stats_lap;             ///< start of the current stage
+    double stats_wall;            ///< wall time at the start
+    clock_t stats_cpu;            ///< CPU time at the start
+
+    sample_pack_fn signal_out;
+    nco_block_fn osc_out;
+
+    enum render_precision precision; ///< pipeline precision, never auto
+    sample_packf_fn signal_outf;
+    nco_blockf_fn osc_outf;
+    sample_packq_fn signal_outq;
+
+    // fixed point levels, Q15
+    int32_t noise_signalq;
+    int32_t noise_floorq;
+    int32_t full_scaleq;
+
+    uint64_t noise_key; ///< noise generator key
+    size_t smp_pos;     ///< absolute sample position
+
+    int g_db;     ///< continuous db
+    double g_hz;  ///< continuous freq
+    uint32_t phi; ///< continuous phase
+
+    // current tone
+    uint32_t d_phi;
+    uint32_t d_from; ///< phase increment ramped from, d_phi for no frequency ramp
+    double g_att;
+    double n_att;
+    size_t tone_len; ///< tone length in samples
+    size_t tone_us;  ///< end of the tones begun so far on the us timeline
+
+    // transition tables, one allocation, shared by the render threads
+    double *step_out;
+    double *step_in;
+    double *step_sum; ///< sums of step_out before each sample, step_len + 1 entries
+    float *step_outf;
+    float *step_inf;
+    int32_t *step_outq;
+    int32_t *step_inq;
+    size_t step_len;
+    int freq_step; ///< ramp the frequency between audible tones
+
+    // frequency steps, the prefix sums of the residual of a step, shared by the render threads
+    double const *freq_c; ///< freq_n + 1 entries, the step sums or the gaussian sums
+    size_t freq_n;
+    ptrdiff_t freq_lo;    ///< first residual sample relative to the step
+    double *gauss_c;      ///< gaussian frequency pulse sums, NULL for plain FSK
+    freq_edge_t edge[MAX_FREQ_EDGES]; ///< steps reaching into the current tone
+    unsigned edges;
+    size_t ramp_head;     ///< samples from the tone start in a step
+    size_t ramp_tail;     ///< first sample in a step of the following tones
+    uint64_t edge_key;    ///< hash of the steps, 0 for none
+
+    filter_state_t filter_state;
+    size_t filter_warmup; ///< samples for the filter state to settle
+    int filter_on;        ///< filter is not flat
+    int filter_long;      ///< filter is more than the inline biquad
+
+    // higher order filter coefficients, sections or FIR taps
+    size_t sections;
+    double sec_a[MAX_SECTIONS][3];
+    double sec_b[MAX_SECTIONS][3];
+    float sec_af[MAX_SECTIONS][3];
+    float sec_bf[MAX_SECTIONS][3];
+    size_t fir_len; ///< taps, 0 if not a FIR
+    double fir_h[MAX_FIR_TAPS];
+    float fir_hf[MAX_FIR_TAPS];
+    int noise_on;         ///< any noise is added
+    void (*disturb)(ctx_t *ctx, size_t len); ///< the disturb kernel
+    int sparse;             ///< leave holes for zero codes in the output file
+    size_t hole;            ///< bytes of zero codes pending as a hole
+    struct writer *writer;  ///< queue frames to a writer thread, or NULL to write directly
+    unsigned write_buffers;
+    uint8_t *map;           ///< output file mapping, the frame is a window into it
+    size_t map_len;
+    size_t map_synced;      ///< bytes of the mapping already synced
+
+    // random access
+    plan_tone_t *plan;   ///< the tones compiled, with an end entry
+    size_t plan_len;     ///< number of tones
+
+    // pull rendering
+    size_t stream_tone;  ///< next tone to begin
+    size_t stream_t;     ///< samples rendered of the current tone
+    uint8_t *stage;      ///< a block for reads shorter than a block
+    size_t stage_len;    ///< bytes in the stage
+    size_t stage_pos;    ///< bytes of the stage already read
+    double silence_level;   ///< filter state below this renders as zero codes
+    int32_t silence_levelq; ///< silence level in Q15
+    filter_log_t *filter_log;
+
+    // repeated tones
+    wave_entry_t *wave_cache; ///< allocated on first use
+    size_t wave_cache_len;    ///< number of entries, 0 is off
+
+    // interpolation to the output rate, the render rate is sample_rate
+    unsigned interp;      ///< interpolation factor, 1 is off
+    size_t interp_skip;   ///< output samples still to drop, the interpolator delay
+    size_t interp_left;   ///< output samples still to write, the render ends within the last render sample
+    double *interp_h;     ///< polyphase taps, taps-major, phases contiguous
+    float *interp_hf;
+    double *interp_xi;    ///< input history, then the block
+    double *interp_xq;
+    float *interp_xif;
+    float *interp_xqf;
+    double *interp_yi;    ///< output, interp samples per input sample
+    double *interp_yq;
+    float *interp_yif;
+    float *interp_yqf;
+    double *interp_zi;    ///< output by phase, before interleaving
+    double *interp_zq;
+    float *interp_zif;
+    float *interp_zqf;
+
+    // block buffers
+    double buf_i[RENDER_CHUNK];
+    double buf_q[RENDER_CHUNK];
+    double noise_si[RENDER_CHUNK]; ///< noise on signal, centered
+    double noise_sq[RENDER_CHUNK];
+    double noise_fi[RENDER_CHUNK]; ///< noise floor, centered
+    double noise_fq[RENDER_CHUNK];
+
+    // higher order filter input, I and Q interleaved, after the FIR history
+    double filter_iq[MAX_FIR_TAPS - 1 + RENDER_CHUNK][2];
+    float filter_iqf[MAX_FIR_TAPS - 1 + RENDER_CHUNK][2];
+
+    // block buffers in single precision
+    float fbuf_i[RENDER_CHUNK];
+    float fbuf_q[RENDER_CHUNK];
+    float fnoise_si[RENDER_CHUNK];
+    float fnoise_sq[RENDER_CHUNK];
+    float fnoise_fi[RENDER_CHUNK];
+    float fnoise_fq[RENDER_CHUNK];
+
+    // block buffers in fixed point
+    int32_t qbuf_i[RENDER_CHUNK];
+    int32_t qbuf_q[RENDER_CHUNK];
+    int32_t qnoise_si[RENDER_CHUNK];
+    int32_t qnoise_sq[RENDER_CHUNK];
+    int32_t qnoise_fi[RENDER_CHUNK];
+    int32_t qnoise_fq[RENDER_CHUNK];
+
+    // zero codes of the output format, the largest sample is 16 bytes
+    uint8_t zero_block[RENDER_CHUNK * 16];
+};
+
+// stats, in iq_render.c
+
+double stats_now(void);
+void stats_begin(ctx_t *ctx);
+void stats_add(iq_render_stats_t *dst, iq_render_stats_t const *src);
+double stats_end(ctx_t *ctx);
+
+// render stages, in iq_render.c
+
+void render_ramp(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att);
+void osc_block(ctx_t *ctx, size_t t0, size_t len);
+void render_noise(ctx_t *ctx, size_t len);
+void render_pack(ctx_t *ctx, size_t len);
+void render_rampf(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att);
+void osc_blockf(ctx_t *ctx, size_t t0, size_t len);
+void render_noisef(ctx_t *ctx, size_t len);
+void render_packf(ctx_t *ctx, size_t len);
+void render_rampq(ctx_t *ctx, size_t t0, size_t len, double g_att, double n_att);
+void osc_blockq(ctx_t *ctx, size_t t0, size_t len);
+void render_noiseq(ctx_t *ctx, size_t len);
+void render_packq(ctx_t *ctx, size_t len);
+int filter_settled(ctx_t *ctx);
+int tone_silent(ctx_t *ctx, size_t t);
+void render_zero(ctx_t *ctx, size_t len);
+void render_wave(ctx_t *ctx, size_t t0, size_t len);
+void tone_render(ctx_t *ctx, size_t t, size_t end);
+
+// render plan, in iq_render.c
+
+void render_plan(ctx_t *ctx, tone_t const *tones);
+void plan_begin(ctx_t *ctx, size_t k);
+void render_seek(ctx_t *ctx, render_cut_t const *cut);
+
+// setup, in iq_render.c
+
+void iq_render_init(ctx_t *ctx, iq_render_t *spec, unsigned interp);
+void render_free(ctx_t *ctx);
+int zero_block_is_zero(ctx_t *ctx);
+
+// output back ends, in iq_output.c
+
+#ifndef _WIN32
+/// Move the frame window forward in the output mapping.
+void signal_out_advance(ctx_t *ctx);
+#endif
+
+/// Write out the frame, to the writer thread, the mapping or the file, and time the wait.
+void signal_out_flush(ctx_t *ctx);
+
+/// Start a writer thread for the output, returns -1 if the output is written directly.
+int writer_open(ctx_t *ctx);
+
+/// Stop the writer thread and restore the frame buffer, returns -1 if any write failed.
+int writer_close(ctx_t *ctx, uint8_t *frame);
+
+#ifndef _WIN32
+/// Map the output file of len bytes to render in place, returns -1 if the file can't be mapped.
+int signal_out_map(ctx_t *ctx, size_t len);
+
+/// Sync and unmap the output file.
+void signal_out_unmap(ctx_t *ctx);
+#endif
+
+/// Render to the file at outpath with checkpoints, resuming from a matching checkpoint, returns the length in us.
+size_t iq_render_checkpointed(ctx_t *ctx, char const *outpath, iq_render_t const *spec, tone_t *tones);
+
+// helper
+
+/// Check if the render was asked to stop.
+static inline int render_aborted(ctx_t const *ctx)
+{
+    return ctx->out_failed || (ctx->flag_abort && *ctx->flag_abort);
+}
+
+/// Add the time since the last lap to a stage, if timing.
+static inline void stats_lap(ctx_t *ctx, double *stage)
+{
+    if (!ctx->stats_on)
+        return;
+    double now = stats_now();
+    *stage += now - ctx->stats_lap;
+    ctx->stats_lap = now;
+}
+
+/// Sum of the step residual before sample x of the table.
+static inline double edge_sum(ctx_t const *ctx, ptrdiff_t x)
+{
+    return x <= 0 ? 0.0 : (size_t)x >= ctx->freq_n ? ctx->freq_c[ctx->freq_n] : ctx->freq_c[x];
+}
+
+/// Phase of the current tone after t samples, relative to the first sample.
+/// Over a step the increment goes from the frequency before to after with the step shape.
+static inline uint32_t tone_phase(ctx_t const *ctx, size_t t)
+{
+    uint32_t phi = (uint32_t)t * ctx->d_phi;
+    for (unsigned k = 0; k < ctx->edges; ++k) {
+        freq_edge_t const *e = &ctx->edge[k];
+        double s = edge_sum(ctx, (ptrdiff_t)t - e->pos) - edge_sum(ctx, -e->pos);
+        phi += (uint32_t)llround(e->delta * s);
+    }
+    return phi;
+}
+
+/// Phase advance over samples [t, t + len) of the current tone.
+static inline uint32_t tone_advance(ctx_t const *ctx, size_t t, size_t len)
+{
+    return tone_phase(ctx, t + len) - tone_phase(ctx, t);
+}
+
+#endif /* INCLUDE_IQRENDERCTX_H_ */
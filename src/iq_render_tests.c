@@ -0,0 +1,176 @@
+/** @file
+    tx_tools - tests for seeking renders.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "iq_render.h"
+
+#define SAMPLE_RATE 1000000
+#define RANGES 24
+#define MAX_RANGE 40000
+
+static unsigned long lcg_state = 1;
+
+static size_t lcg(size_t n)
+{
+    lcg_state = lcg_state * 1103515245UL + 12345UL;
+    return (size_t)((lcg_state >> 8) % n);
+}
+
+/// Bursts of OOK and FSK codes with gaps of silence, about 2.5 s.
+static tone_t *make_tones(void)
+{
+    size_t count = 4096;
+    tone_t *tones = calloc(count + 1, sizeof(*tones));
+    if (!tones) {
+        fprintf(stderr, "Failed to allocate tones.\n");
+        exit(1);
+    }
+
+    size_t k = 0;
+    size_t us = 0;
+    while (k < count - 1 && us < 2500000) {
+        // a burst
+        int fsk = (int)lcg(2);
+        for (size_t j = 0; j < 64 && k < count - 1; ++j) {
+            int bit = (int)lcg(2);
+            tones[k++] = (tone_t){.hz = fsk ? (bit ? 50000 : -50000) : 100000, .db = fsk || bit ? -3 : -100, .us = 100 + 400 * bit};
+            us += 100 + 400 * (size_t)bit;
+        }
+        // a gap
+        size_t gap = 1000 + lcg(60000);
+        tones[k++] = (tone_t){.hz = 0, .db = -100, .us = (int)gap};
+        us += gap;
+    }
+    return tones;
+}
+
+/// Largest difference of the I/Q values of two blocks, in LSB or in full scale for CF32.
+static double range_error(enum sample_format format, uint8_t const *a, uint8_t const *b, size_t len)
+{
+    double err = 0.0;
+    for (size_t k = 0; k < 2 * len; ++k) {
+        double d;
+        if (format == FORMAT_CF32)
+            d = fabs((double)((float const *)a)[k] - (double)((float const *)b)[k]);
+        else if (format == FORMAT_CS16)
+            d = abs(((int16_t const *)a)[k] - ((int16_t const *)b)[k]);
+        else if (format == FORMAT_CS8)
+            d = abs(((int8_t const *)a)[k] - ((int8_t const *)b)[k]);
+        else
+            d = abs(a[k] - b[k]);
+        if (d > err)
+            err = d;
+    }
+    return err;
+}
+
+static size_t check_ranges(iq_render_t *spec, tone_t *tones, char const *name)
+{
+    uint8_t *full;
+    size_t full_len;
+    iq_render_buf(spec, tones, (void **)&full, &full_len);
+
+    iq_render_ctx_t *ctx = iq_render_open(spec, tones);
+    if (!ctx)
+        exit(1);
+    size_t smp  = iq_render_length(ctx);
+    size_t size = full_len / smp;
+    uint8_t *buf = malloc(MAX_RANGE * size);
+    if (!buf) {
+        fprintf(stderr, "Failed to allocate range buffer.\n");
+        exit(1);
+    }
+
+    size_t fails = 0;
+    size_t b     = 0;
+    for (size_t r = 0; r < RANGES; ++r) {
+        // random ranges, every fourth one continues the last
+        size_t a = r % 4 == 3 ? b : lcg(smp);
+        b        = a + 1 + lcg(MAX_RANGE);
+        if (b > smp)
+            b = smp;
+        size_t n = iq_render_range(ctx, a, b, buf);
+        // the Butterworth state is warmed up, not exact
+        double err = n == b - a ? range_error(spec->sample_format, buf, full + a * size, n) : HUGE_VAL;
+        if (err > (spec->sample_format == FORMAT_CF32 ? 1e-5 : 1.0)) {
+            fprintf(stderr, "%s: range [%zu, %zu) differs from the full render by %g.\n", name, a, b, err);
+            fails += 1;
+        }
+    }
+
+    iq_render_close(ctx);
+    free(buf);
+    free(full);
+    return fails;
+}
+
+int main(int argc, char **argv)
+{
+    tone_t *tones = make_tones();
+
+    struct {
+        enum render_precision precision;
+        enum sample_format format;
+    } const kinds[] = {
+            {PRECISION_DOUBLE, FORMAT_CU8},
+            {PRECISION_DOUBLE, FORMAT_CS16},
+            {PRECISION_DOUBLE, FORMAT_CF32},
+            {PRECISION_FLOAT, FORMAT_CS8},
+            {PRECISION_FLOAT, FORMAT_CS16},
+            {PRECISION_FLOAT, FORMAT_CF32},
+            {PRECISION_FIXED, FORMAT_CS8},
+            {PRECISION_FIXED, FORMAT_CS16},
+    };
+    double const filters[] = {0.1, 0.01, 0.002};
+
+    size_t fails = 0;
+    size_t tests = 0;
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(*kinds); ++k) {
+        for (size_t f = 0; f < sizeof(filters) / sizeof(*filters); ++f) {
+            for (int noise = 0; noise < 2; ++noise) {
+                iq_render_t spec = {0};
+                iq_render_defaults(&spec);
+                spec.sample_rate   = SAMPLE_RATE;
+                spec.precision     = kinds[k].precision;
+                spec.sample_format = kinds[k].format;
+                spec.filter_wc     = filters[f];
+                spec.quiet         = 1;
+                if (!noise)
+                    spec.noise_floor = spec.noise_signal = 0.0;
+
+                char name[64];
+                snprintf(name, sizeof(name), "%s %s -W %g%s",
+                        kinds[k].precision == PRECISION_DOUBLE ? "double" : kinds[k].precision == PRECISION_FLOAT ? "float" : "fixed",
+                        sample_format_str(kinds[k].format), filters[f], noise ? "" : " no noise");
+                fails += check_ranges(&spec, tones, name);
+                tests += RANGES;
+            }
+        }
+    }
+
+    free(tones);
+
+    printf("%zu of %zu ranges differ.\n", fails, tests);
+    return fails ? 1 : 0;
+}
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h> // for ssize_t
+#include <pthread.h>
 
 #include <math.h>
 #ifndef M_PI
@@ -29,12 +30,35 @@
 // numerically controlled oscillator (NCO)
 
 static double nco_sin_lut[1024];
+static double nco_interp_lut[4096 + 1]; ///< one extra entry to interpolate the last step
+static float nco_sin_lutf[1024];
+static float nco_interp_lutf[4096 + 1];
+static int16_t nco_sin_lutq[1024]; ///< Q15
+static pthread_once_t nco_once = PTHREAD_ONCE_INIT;
 
-static void nco_init(void)
+static void nco_build(void)
 {
     for (int i = 0; i < 1024; ++i) {
         nco_sin_lut[i] = sin(2.0 * M_PI * i / 1024.0);
     }
+    for (int i = 0; i <= 4096; ++i) {
+        nco_interp_lut[i] = sin(2.0 * M_PI * i / 4096.0);
+    }
+    for (int i = 0; i < 1024; ++i) {
+        nco_sin_lutf[i] = (float)nco_sin_lut[i];
+    }
+    for (int i = 0; i <= 4096; ++i) {
+        nco_interp_lutf[i] = (float)nco_interp_lut[i];
+    }
+    for (int i = 0; i < 1024; ++i) {
+        nco_sin_lutq[i] = (int16_t)lrint(nco_sin_lut[i] * 32767.0);
+    }
+}
+
+/// Build the tables once, the tables are read-only after, and shared by all threads.
+static void nco_init(void)
+{
+    pthread_once(&nco_once, nco_build);
 }
 
 static double nco_sin_ratio(double x)
@@ -76,17 +100,185 @@ static double nco_cos(uint32_t phi)
     return nco_sin_lut[i];
 }
 
+// interpolated LUT, 12 bits index and 20 bits fraction
+
+static double nco_sin_interp(uint32_t phi)
+{
+    unsigned int i = phi >> 20;
+    double f = (phi & 0xfffff) * (1.0 / 1048576.0);
+    return nco_interp_lut[i] + f * (nco_interp_lut[i + 1] - nco_interp_lut[i]);
+}
+
+static double nco_cos_interp(uint32_t phi)
+{
+    return nco_sin_interp(phi + 0x40000000); // quarter turn
+}
+
+// NCO engines, cos and sin for len samples from phase phi, returns the next phase
+
+typedef uint32_t (*nco_block_fn)(uint32_t phi, uint32_t d_phi, size_t len, double *c, double *s);
+
+/// Rounded 1024 entry LUT, SFDR is about 60 dB.
+static uint32_t nco_block_lut(uint32_t phi, uint32_t d_phi, size_t len, double *c, double *s)
+{
+    for (size_t t = 0; t < len; ++t) {
+        c[t] = nco_cos(phi);
+        s[t] = nco_sin(phi);
+        phi += d_phi;
+    }
+    return phi;
+}
+
+/// Linear interpolated 4096 entry LUT, SFDR is about 130 dB.
+static uint32_t nco_block_interp(uint32_t phi, uint32_t d_phi, size_t len, double *c, double *s)
+{
+    for (size_t t = 0; t < len; ++t) {
+        c[t] = nco_cos_interp(phi);
+        s[t] = nco_sin_interp(phi);
+        phi += d_phi;
+    }
+    return phi;
+}
+
+#define NCO_LANES 8 ///< independent rotators, interleaved, a power of 2
+
+/// Complex rotator recurrence, no table lookups.
+/// Each block restarts from the exact phase, i.e. the rotator is renormalized
+/// in magnitude and phase and the error only accumulates over len / NCO_LANES steps.
+static uint32_t nco_block_rotator(uint32_t phi, uint32_t d_phi, size_t len, double *c, double *s)
+{
+    double const rad = 2.0 * M_PI / 4294967296.0;
+    double zr[NCO_LANES], zi[NCO_LANES];
+    zr[0] = cos(rad * phi);
+    zi[0] = sin(rad * phi);
+    double wr = cos(rad * d_phi);
+    double wi = sin(rad * d_phi);
+    for (int k = 1; k < NCO_LANES; ++k) {
+        zr[k] = zr[k - 1] * wr - zi[k - 1] * wi;
+        zi[k] = zr[k - 1] * wi + zi[k - 1] * wr;
+    }
+    // step all lanes by NCO_LANES samples
+    for (int k = 1; k < NCO_LANES; k <<= 1) {
+        double r = wr * wr - wi * wi;
+        wi = 2.0 * wr * wi;
+        wr = r;
+    }
+
+    size_t t = 0;
+    for (; t + NCO_LANES <= len; t += NCO_LANES) {
+        for (int k = 0; k < NCO_LANES; ++k) {
+            c[t + k] = zr[k];
+            s[t + k] = zi[k];
+            double r = zr[k] * wr - zi[k] * wi;
+            double i = zr[k] * wi + zi[k] * wr;
+            zr[k] = r;
+            zi[k] = i;
+        }
+    }
+    for (int k = 0; t < len; ++t, ++k) {
+        c[t] = zr[k];
+        s[t] = zi[k];
+    }
+    return phi + (uint32_t)len * d_phi;
+}
+
+// NCO engines in single precision
+
+typedef uint32_t (*nco_blockf_fn)(uint32_t phi, uint32_t d_phi, size_t len, float *c, float *s);
+
+static uint32_t nco_blockf_lut(uint32_t phi, uint32_t d_phi, size_t len, float *c, float *s)
+{
+    for (size_t t = 0; t < len; ++t) {
+        unsigned int i = ((phi + (1 << 21)) >> 22) & 0x3ff; // round
+        c[t] = nco_sin_lutf[(i + 256) & 0x3ff];
+        s[t] = nco_sin_lutf[i];
+        phi += d_phi;
+    }
+    return phi;
+}
+
+static uint32_t nco_blockf_interp(uint32_t phi, uint32_t d_phi, size_t len, float *c, float *s)
+{
+    for (size_t t = 0; t < len; ++t) {
+        uint32_t pc = phi + 0x40000000; // quarter turn
+        unsigned int ic = pc >> 20;
+        unsigned int is = phi >> 20;
+        float fc = (pc & 0xfffff) * (1.0f / 1048576.0f);
+        float fs = (phi & 0xfffff) * (1.0f / 1048576.0f);
+        c[t] = nco_interp_lutf[ic] + fc * (nco_interp_lutf[ic + 1] - nco_interp_lutf[ic]);
+        s[t] = nco_interp_lutf[is] + fs * (nco_interp_lutf[is + 1] - nco_interp_lutf[is]);
+        phi += d_phi;
+    }
+    return phi;
+}
+
+/// Complex rotator in float, the lanes start exact from double and drift about 1e-5 over a block.
+static uint32_t nco_blockf_rotator(uint32_t phi, uint32_t d_phi, size_t len, float *c, float *s)
+{
+    double const rad = 2.0 * M_PI / 4294967296.0;
+    float zr[NCO_LANES], zi[NCO_LANES];
+    for (int k = 0; k < NCO_LANES; ++k) {
+        uint32_t p = phi + (uint32_t)k * d_phi;
+        zr[k] = (float)cos(rad * p);
+        zi[k] = (float)sin(rad * p);
+    }
+    uint32_t d_lanes = (uint32_t)NCO_LANES * d_phi;
+    float wr = (float)cos(rad * d_lanes);
+    float wi = (float)sin(rad * d_lanes);
+
+    size_t t = 0;
+    for (; t + NCO_LANES <= len; t += NCO_LANES) {
+        for (int k = 0; k < NCO_LANES; ++k) {
+            c[t + k] = zr[k];
+            s[t + k] = zi[k];
+            float r = zr[k] * wr - zi[k] * wi;
+            float i = zr[k] * wi + zi[k] * wr;
+            zr[k] = r;
+            zi[k] = i;
+        }
+    }
+    for (int k = 0; t < len; ++t, ++k) {
+        c[t] = zr[k];
+        s[t] = zi[k];
+    }
+    return phi + (uint32_t)len * d_phi;
+}
+
+// NCO engine in fixed point, Q15
+
+static uint32_t nco_blockq_lut(uint32_t phi, uint32_t d_phi, size_t len, int32_t *c, int32_t *s)
+{
+    for (size_t t = 0; t < len; ++t) {
+        unsigned int i = ((phi + (1 << 21)) >> 22) & 0x3ff; // round
+        c[t] = nco_sin_lutq[(i + 256) & 0x3ff];
+        s[t] = nco_sin_lutq[i];
+        phi += d_phi;
+    }
+    return phi;
+}
+
 // LUT dB
 
 static double db_lut[256];
+static pthread_once_t db_once = PTHREAD_ONCE_INIT;
 
-static void init_db_lut(void)
+static void db_lut_build(void)
 {
     for (int db = -128; db <= 127; ++db)
         db_lut[128 + db] = pow(10.0, 1.0/20.0 * db);
 }
 
+/// Build the table once, safe to call from any thread.
+static void init_db_lut(void)
+{
+    pthread_once(&db_once, db_lut_build);
+}
+
 static double db_to_mag(int db)
 {
+    if (db <= -100)
+        return 0.0; // -100dB is always assumed silence
+    if (db > 127)
+        db = 127;
     return db_lut[128 + db];
 }
@@ -0,0 +1,172 @@
+/** @file
+    tx_tools - counter based noise generator.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_NOISE_H_
+#define INCLUDE_NOISE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+// counter based random numbers (SplitMix64 mixing of key and counter)
+//
+// The value for a counter depends only on the key and the counter,
+// i.e. any position in the stream can be generated directly, without state.
+
+/// Derive a generator key from a user seed.
+static inline uint64_t noise_key(unsigned seed)
+{
+    uint64_t z = (uint64_t)seed * 0x9e3779b97f4a7c15ULL + 0x2545f4914f6cdd1dULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// Random 64 bits for a counter.
+static inline uint64_t noise_hash(uint64_t key, uint64_t ctr)
+{
+    uint64_t z = key + (ctr + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// Centered uniform value in [-0.5, 0.5) from 32 random bits.
+static inline double noise_uniform(uint32_t bits)
+{
+    return (int32_t)bits * (1.0 / 4294967296.0);
+}
+
+/// Fill a block with centered uniform noise for samples [pos, pos + len).
+/// Each sample uses two counters for the four values:
+/// noise on signal (I, Q) and noise floor (I, Q).
+static inline void noise_uniform_block(uint64_t key, uint64_t pos, size_t len,
+        double *si, double *sq, double *fi, double *fq)
+{
+    for (size_t t = 0; t < len; ++t) {
+        uint64_t a = noise_hash(key, 2 * (pos + t));
+        uint64_t b = noise_hash(key, 2 * (pos + t) + 1);
+        si[t] = noise_uniform((uint32_t)a);
+        sq[t] = noise_uniform((uint32_t)(a >> 32));
+        fi[t] = noise_uniform((uint32_t)b);
+        fq[t] = noise_uniform((uint32_t)(b >> 32));
+    }
+}
+
+/// Fill a block with centered uniform noise in single precision, the values of noise_uniform_block() rounded.
+static inline void noise_uniform_blockf(uint64_t key, uint64_t pos, size_t len,
+        float *si, float *sq, float *fi, float *fq)
+{
+    for (size_t t = 0; t < len; ++t) {
+        uint64_t a = noise_hash(key, 2 * (pos + t));
+        uint64_t b = noise_hash(key, 2 * (pos + t) + 1);
+        si[t] = (int32_t)(uint32_t)a * (1.0f / 4294967296.0f);
+        sq[t] = (int32_t)(uint32_t)(a >> 32) * (1.0f / 4294967296.0f);
+        fi[t] = (int32_t)(uint32_t)b * (1.0f / 4294967296.0f);
+        fq[t] = (int32_t)(uint32_t)(b >> 32) * (1.0f / 4294967296.0f);
+    }
+}
+
+// gaussian noise (Box-Muller with branch-free approximations of log and sincos)
+
+/// Natural logarithm for x in (0, 1], abs error below 1e-12.
+static inline double noise_log(double x)
+{
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    // center the mantissa to [sqrt(1/2), sqrt(2)), i.e. carry if above 0x6a09e667f3bcd
+    uint64_t mant = bits & 0x000fffffffffffffULL;
+    uint64_t big  = (mant + 0x00095f619980c433ULL) >> 52;
+    uint64_t mb   = mant | ((0x3ffULL - big) << 52);
+    double m;
+    memcpy(&m, &mb, sizeof(m));
+    // exponent as double without int64 conversion
+    uint64_t eb = 0x4330000000000000ULL | ((bits >> 52) + big);
+    double e;
+    memcpy(&e, &eb, sizeof(e));
+    e -= 4503599627370496.0 + 1023.0;
+    double s = (m - 1.0) / (m + 1.0);
+    double z = s * s;
+    double p = 1.0 / 15 + z * (1.0 / 17);
+    p = 1.0 / 13 + z * p;
+    p = 1.0 / 11 + z * p;
+    p = 1.0 / 9 + z * p;
+    p = 1.0 / 7 + z * p;
+    p = 1.0 / 5 + z * p;
+    p = 1.0 / 3 + z * p;
+    p = 1.0 + z * p;
+    return e * 0.6931471805599453 + 2.0 * s * p;
+}
+
+/// Cosine and sine of 2 pi u for u in [-0.5, 0.5), abs error below 1e-12.
+static inline void noise_sincos(double u, double *c, double *s)
+{
+    // evaluate at a quarter of the angle, then double the angle twice
+    double x  = u * (2.0 * 3.14159265358979323846 / 4.0); // [-pi/4, pi/4)
+    double x2 = x * x;
+    double sp = 1.0 / 39916800 - x2 * (1.0 / 6227020800);
+    sp = 1.0 / 362880 - x2 * sp;
+    sp = 1.0 / 5040 - x2 * sp;
+    sp = 1.0 / 120 - x2 * sp;
+    sp = 1.0 / 6 - x2 * sp;
+    double sn = x - x * x2 * sp;
+    double cp = 1.0 / 3628800 - x2 * (1.0 / 479001600);
+    cp = 1.0 / 40320 - x2 * cp;
+    cp = 1.0 / 720 - x2 * cp;
+    cp = 1.0 / 24 - x2 * cp;
+    cp = 0.5 - x2 * cp;
+    double cs = 1.0 - x2 * cp;
+    // double angle, twice
+    double s2 = 2.0 * sn * cs;
+    double c2 = cs * cs - sn * sn;
+    *s = 2.0 * s2 * c2;
+    *c = c2 * c2 - s2 * s2;
+}
+
+/// Fill a block with standard normal noise for samples [pos, pos + len).
+/// Each sample uses three counters for two Box-Muller pairs:
+/// noise on signal (I, Q) and noise floor (I, Q).
+static inline void noise_gaussian_block(uint64_t key, uint64_t pos, size_t len,
+        double *si, double *sq, double *fi, double *fq)
+{
+    for (size_t t = 0; t < len; ++t) {
+        uint64_t a = noise_hash(key, 3 * (pos + t));
+        uint64_t b = noise_hash(key, 3 * (pos + t) + 1);
+        uint64_t c = noise_hash(key, 3 * (pos + t) + 2);
+        // radius from (0, 1] with 53 bits, angle from [-0.5, 0.5) with 32 bits
+        si[t] = ((a >> 11) + 1) * (1.0 / 9007199254740992.0);
+        fi[t] = ((b >> 11) + 1) * (1.0 / 9007199254740992.0);
+        sq[t] = noise_uniform((uint32_t)c);
+        fq[t] = noise_uniform((uint32_t)(c >> 32));
+    }
+    for (size_t t = 0; t < len; ++t) {
+        double rs = sqrt(-2.0 * noise_log(si[t]));
+        double rf = sqrt(-2.0 * noise_log(fi[t]));
+        double cs, ss, cf, sf;
+        noise_sincos(sq[t], &cs, &ss);
+        noise_sincos(fq[t], &cf, &sf);
+        si[t] = rs * cs;
+        sq[t] = rs * ss;
+        fi[t] = rf * cf;
+        fq[t] = rf * sf;
+    }
+}
+
+#endif /* INCLUDE_NOISE_H_ */
@@ -114,6 +114,10 @@ static void parse_param(char const **buf, pulse_setup_t *params)
         params->phase_mark = atoi(e);
     else if (e - p == 11 && !strncmp(p, "phase_space", 11))
         params->phase_space = atoi(e);
+    else if (e - p == 8 && !strncmp(p, "gauss_bt", 8))
+        params->gauss_bt = atof(e);
+    else if (e - p == 10 && !strncmp(p, "symbol_len", 10))
+        params->symbol_len = (unsigned)atoi(e);
 
     // skip to eol
     while (*p && *p != '\r' && *p != '\n')
@@ -154,7 +158,20 @@ static int parse_len(char const **buf)
 
 void pulse_setup_defaults(pulse_setup_t *params, char const *name)
 {
-    if (name && (*name == 'F' || *name == 'f')) {
+    params->gauss_bt   = 0.0;
+    params->symbol_len = 0;
+    if (name && (*name == 'G' || *name == 'g')) {
+        // GFSK
+        params->time_base   = 1000000;
+        params->freq_mark   = 50000;
+        params->freq_space  = -50000;
+        params->att_mark    = -1;
+        params->att_space   = -1;
+        params->phase_mark  = 0;
+        params->phase_space = 0;
+        params->gauss_bt    = 0.5;
+    }
+    else if (name && (*name == 'F' || *name == 'f')) {
         // FSK
         params->time_base   = 1000000;
         params->freq_mark   = 50000;
@@ -206,6 +223,10 @@ void pulse_setup_print(pulse_setup_t *params)
     printf(";att_space %d\n", params->att_space);
     printf(";phase_mark %d\n", params->phase_mark);
     printf(";phase_space %d\n", params->phase_space);
+    if (params->gauss_bt > 0.0) {
+        printf(";gauss_bt %g\n", params->gauss_bt);
+        printf(";symbol_len %u\n", params->symbol_len);
+    }
 }
 
 tone_t *parse_pulses(char const *pulses, pulse_setup_t *defaults)
@@ -294,6 +315,18 @@ tone_t *parse_pulses(char const *pulses, pulse_setup_t *defaults)
     return tones;
 }
 
+double pulse_symbol_rate(tone_t const *tones, pulse_setup_t const *params)
+{
+    if (params->symbol_len)
+        return (double)params->time_base / params->symbol_len;
+
+    int shortest = 0;
+    for (tone_t const *t = tones; t && (t->us || t->hz); ++t)
+        if (t->us > 0 && (!shortest || t->us < shortest))
+            shortest = t->us;
+    return shortest ? 1000000.0 / shortest : 0.0;
+}
+
 tone_t *parse_pulses_file(char const *filename, pulse_setup_t *defaults)
 {
     char const *text = read_text_file(filename);
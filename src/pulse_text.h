@@ -31,6 +31,8 @@ typedef struct pulse_setup {
     int att_space;      ///< attenuation for space (dB), -100 for silence
     int phase_mark;     ///< phase offset for mark, 0 otherwise
     int phase_space;    ///< phase offset for space, 0 otherwise
+    double gauss_bt;    ///< GFSK bandwidth-time product, 0 otherwise
+    unsigned symbol_len; ///< GFSK symbol length in time_base units, 0 for the shortest pulse
 } pulse_setup_t;
 
 // parsing pulse data from string or reading in
@@ -43,6 +45,9 @@ tone_t *parse_pulses(char const *pulses, pulse_setup_t *defaults);
 
 tone_t *parse_pulses_file(char const *filename, pulse_setup_t *defaults);
 
+/// GFSK symbol rate of the pulses, from the symbol length or the shortest pulse.
+double pulse_symbol_rate(tone_t const *tones, pulse_setup_t const *params);
+
 // debug output to stdout
 
 void output_pulses(tone_t const *tones);
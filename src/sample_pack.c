@@ -0,0 +1,954 @@
+/** @file
+    tx_tools - sample_pack, convert I/Q blocks to sample formats.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sample_pack.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// helper
+
+static inline uint8_t bound_u4(int x)
+{
+    return x < 0 ? 0 : x > 0xf ? 0xf : (uint8_t)x;
+}
+
+static inline int8_t bound_s4(int x)
+{
+    return x < -0x8 ? -0x8 : x > 0x7 ? 0x7 : (int8_t)x;
+}
+
+static inline uint8_t bound_u8(int x)
+{
+    return x < 0 ? 0 : x > 0xff ? 0xff : (uint8_t)x;
+}
+
+static inline int8_t bound_s8(int x)
+{
+    return x < -0x80 ? -0x80 : x > 0x7f ? 0x7f : (int8_t)x;
+}
+
+static inline uint16_t bound_u16(int x)
+{
+    return x < 0 ? 0 : x > 0xffff ? 0xffff : (uint16_t)x;
+}
+
+static inline int16_t bound_s16(int x)
+{
+    return x < -0x8000 ? -0x8000 : x > 0x7fff ? 0x7fff : (int16_t)x;
+}
+
+static inline uint32_t bound_u32(double x)
+{
+    return x < 0 ? 0 : x > 0xffffffff ? 0xffffffff : (uint32_t)x;
+}
+
+static inline int32_t bound_s32(double x)
+{
+    return x < -0x7fffffff ? -0x7fffffff : x > 0x7fffffff ? 0x7fffffff : (int32_t)x;
+}
+
+static inline uint64_t bound_u64(double x)
+{
+    return x < 0 ? 0 : x > 0xffffffffffffffff ? 0xffffffffffffffff : (uint64_t)x;
+}
+
+static inline int64_t bound_s64(double x)
+{
+    return x < -0x7fffffffffffffff ? -0x7fffffffffffffff : x > 0x7fffffffffffffff ? 0x7fffffffffffffff : (int64_t)x;
+}
+
+// scalar converters, these define the exact output for all variants
+
+static void pack_cu4(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint8_t *o = out;
+    // scale [-1.0, 1.0] to [0, 15] with uniform distribution,
+    // i.e. bias 7.5 -- not Excess-8
+    // this exact scale prevents 1.0==16
+    for (size_t t = 0; t < len; ++t) {
+        uint8_t i8 = bound_u4((int)(i[t] * 7.999999 + 7.5 + 0.5));
+        uint8_t q8 = bound_u4((int)(q[t] * 7.999999 + 7.5 + 0.5));
+        *o++ = (uint8_t)(i8 << 4) | (q8);
+    }
+}
+
+static void pack_cs4(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint8_t *o = out;
+    // scale [-1.0, 1.0] to [-7, 7] with uniform distribution
+    // this exact scale prevents 1.0==8, -1.0==-8
+    for (size_t t = 0; t < len; ++t) {
+        int8_t i8 = bound_s4((int)(i[t] * 7.49999 + 8 + 0.5) - 8);
+        int8_t q8 = bound_s4((int)(q[t] * 7.49999 + 8 + 0.5) - 8);
+        *o++ = (uint8_t)(i8 << 4) | (q8 & 0xf);
+    }
+}
+
+static void pack_cu8(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint8_t *o = out;
+    // scale [-1.0, 1.0] to [0, 255] with uniform distribution,
+    // i.e. bias 127.5 -- not Excess-128
+    // this exact scale prevents 1.0==256
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u8((int)(i[t] * 127.999999 + 127.5 + 0.5));
+        *o++ = bound_u8((int)(q[t] * 127.999999 + 127.5 + 0.5));
+    }
+}
+
+static void pack_cs8(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    int8_t *o = out;
+    // scale [-1.0, 1.0] to [-127, 127] with uniform distribution
+    // this exact scale prevents 1.0==128, -1.0==-128
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s8((int)(i[t] * 127.4999 + 128 + 0.5) - 128);
+        *o++ = bound_s8((int)(q[t] * 127.4999 + 128 + 0.5) - 128);
+    }
+}
+
+static void pack_cu12(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        uint16_t i8 = bound_u16((int)((i[t] + 1.0) * full_scale));
+        uint16_t q8 = bound_u16((int)((q[t] + 1.0) * full_scale));
+        // produce 24 bit (iiqIQQ), note the input is LSB aligned, scale=2048
+        // note: byte0 = i[7:0]; byte1 = {q[3:0], i[11:8]}; byte2 = q[11:4];
+        *o++ = (uint8_t)(i8);
+        *o++ = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
+        *o++ = (uint8_t)(q8 >> 4);
+    }
+}
+
+static void pack_cs12(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        int16_t i8 = bound_s16((int)(i[t] * full_scale + 2048 + 0.5) - 2048);
+        int16_t q8 = bound_s16((int)(q[t] * full_scale + 2048 + 0.5) - 2048);
+        // produce 24 bit (iiqIQQ), note the input is LSB aligned, scale=2048
+        // note: byte0 = i[7:0]; byte1 = {q[3:0], i[11:8]}; byte2 = q[11:4];
+        *o++ = (uint8_t)(i8);
+        *o++ = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
+        *o++ = (uint8_t)(q8 >> 4);
+    }
+}
+
+static void pack_cu16(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint16_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u16((int)((i[t] + 1.0) * full_scale));
+        *o++ = bound_u16((int)((q[t] + 1.0) * full_scale));
+    }
+}
+
+static void pack_cs16(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    int16_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s16((int)(i[t] * full_scale + 32768 + 0.5) - 32768);
+        *o++ = bound_s16((int)(q[t] * full_scale + 32768 + 0.5) - 32768);
+    }
+}
+
+static void pack_cu32(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint32_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u32((i[t] + 1.0) * full_scale);
+        *o++ = bound_u32((q[t] + 1.0) * full_scale);
+    }
+}
+
+static void pack_cs32(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    int32_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s32(i[t] * full_scale);
+        *o++ = bound_s32(q[t] * full_scale);
+    }
+}
+
+static void pack_cu64(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    uint64_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u64((i[t] + 1.0) * full_scale);
+        *o++ = bound_u64((q[t] + 1.0) * full_scale);
+    }
+}
+
+static void pack_cs64(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    int64_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s64(i[t] * full_scale);
+        *o++ = bound_s64(q[t] * full_scale);
+    }
+}
+
+/// Adding zero turns a negative residue that rounds to -0.0f into 0.0f, i.e. the zero code of silence.
+static void pack_cf32(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    float *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = (float)(i[t] * full_scale) + 0.0f;
+        *o++ = (float)(q[t] * full_scale) + 0.0f;
+    }
+}
+
+static void pack_cf64(void *out, double const *i, double const *q, size_t len, double full_scale)
+{
+    double *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = i[t] * full_scale;
+        *o++ = q[t] * full_scale;
+    }
+}
+
+// scalar float converters, same scaling computed in single precision
+
+static void packf_cu4(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        uint8_t i8 = bound_u4((int)(i[t] * 7.999999f + 7.5f + 0.5f));
+        uint8_t q8 = bound_u4((int)(q[t] * 7.999999f + 7.5f + 0.5f));
+        *o++ = (uint8_t)(i8 << 4) | (q8);
+    }
+}
+
+static void packf_cs4(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        int8_t i8 = bound_s4((int)(i[t] * 7.49999f + 8.0f + 0.5f) - 8);
+        int8_t q8 = bound_s4((int)(q[t] * 7.49999f + 8.0f + 0.5f) - 8);
+        *o++ = (uint8_t)(i8 << 4) | (q8 & 0xf);
+    }
+}
+
+static void packf_cu8(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u8((int)(i[t] * 127.999999f + 127.5f + 0.5f));
+        *o++ = bound_u8((int)(q[t] * 127.999999f + 127.5f + 0.5f));
+    }
+}
+
+static void packf_cs8(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    int8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s8((int)(i[t] * 127.4999f + 128.0f + 0.5f) - 128);
+        *o++ = bound_s8((int)(q[t] * 127.4999f + 128.0f + 0.5f) - 128);
+    }
+}
+
+static void packf_cu12(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        uint16_t i8 = bound_u16((int)((i[t] + 1.0f) * full_scale));
+        uint16_t q8 = bound_u16((int)((q[t] + 1.0f) * full_scale));
+        *o++ = (uint8_t)(i8);
+        *o++ = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
+        *o++ = (uint8_t)(q8 >> 4);
+    }
+}
+
+static void packf_cs12(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint8_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        int16_t i8 = bound_s16((int)(i[t] * full_scale + 2048.0f + 0.5f) - 2048);
+        int16_t q8 = bound_s16((int)(q[t] * full_scale + 2048.0f + 0.5f) - 2048);
+        *o++ = (uint8_t)(i8);
+        *o++ = (uint8_t)((q8 << 4) | ((i8 >> 8) & 0x0f));
+        *o++ = (uint8_t)(q8 >> 4);
+    }
+}
+
+static void packf_cu16(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint16_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u16((int)((i[t] + 1.0f) * full_scale));
+        *o++ = bound_u16((int)((q[t] + 1.0f) * full_scale));
+    }
+}
+
+static void packf_cs16(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    int16_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s16((int)(i[t] * full_scale + 32768.0f + 0.5f) - 32768);
+        *o++ = bound_s16((int)(q[t] * full_scale + 32768.0f + 0.5f) - 32768);
+    }
+}
+
+static void packf_cu32(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint32_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u32((double)((i[t] + 1.0f) * full_scale));
+        *o++ = bound_u32((double)((q[t] + 1.0f) * full_scale));
+    }
+}
+
+static void packf_cs32(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    int32_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s32((double)(i[t] * full_scale));
+        *o++ = bound_s32((double)(q[t] * full_scale));
+    }
+}
+
+static void packf_cu64(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    uint64_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_u64((double)((i[t] + 1.0f) * full_scale));
+        *o++ = bound_u64((double)((q[t] + 1.0f) * full_scale));
+    }
+}
+
+static void packf_cs64(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    int64_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s64((double)(i[t] * full_scale));
+        *o++ = bound_s64((double)(q[t] * full_scale));
+    }
+}
+
+static void packf_cf32(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    float *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = i[t] * full_scale;
+        *o++ = q[t] * full_scale;
+    }
+}
+
+static void packf_cf64(void *out, float const *i, float const *q, size_t len, float full_scale)
+{
+    double *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = (double)(i[t] * full_scale);
+        *o++ = (double)(q[t] * full_scale);
+    }
+}
+
+// fixed point, Q15 values with saturation
+
+static void packq_cs8(void *out, int32_t const *i, int32_t const *q, size_t len, int32_t scale)
+{
+    int8_t *o = out;
+    // like pack_cs8() the scale is fixed to [-127, 127]
+    int64_t s = (int64_t)(127.4999 * 32768.0);
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s8((int)((i[t] * s + (1 << 29)) >> 30));
+        *o++ = bound_s8((int)((q[t] * s + (1 << 29)) >> 30));
+    }
+}
+
+static void packq_cs16(void *out, int32_t const *i, int32_t const *q, size_t len, int32_t scale)
+{
+    int16_t *o = out;
+    for (size_t t = 0; t < len; ++t) {
+        *o++ = bound_s16((int)(((int64_t)i[t] * scale + (1 << 29)) >> 30));
+        *o++ = bound_s16((int)(((int64_t)q[t] * scale + (1 << 29)) >> 30));
+    }
+}
+
+#ifdef HAS_X86_SIMD
+
+// SIMD converters, each step converts to int32 lanes, then narrows and interleaves.
+// The arithmetic mirrors the scalar expressions operation by operation
+// (no FMA contraction) so all variants produce identical output.
+
+/// Interleave 4 I and 4 Q int32 lanes to 8 int16 with signed saturation.
+static inline __m128i interleave4_s16(__m128i vi, __m128i vq)
+{
+    __m128i w = _mm_packs_epi32(vi, vq); // i0 i1 i2 i3 q0 q1 q2 q3
+    return _mm_unpacklo_epi16(w, _mm_srli_si128(w, 8));
+}
+
+/// Clamp int32 lanes to [0, 0xffff].
+static inline __m128i clamp4_u16(__m128i x)
+{
+    x = _mm_and_si128(x, _mm_cmpgt_epi32(x, _mm_set1_epi32(-1)));
+    __m128i m = _mm_cmpgt_epi32(x, _mm_set1_epi32(0xffff));
+    return _mm_or_si128(_mm_andnot_si128(m, x), _mm_and_si128(m, _mm_set1_epi32(0xffff)));
+}
+
+static inline void store4_cu4(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i w = interleave4_s16(vi, vq);
+    w = _mm_max_epi16(_mm_min_epi16(w, _mm_set1_epi16(0xf)), _mm_setzero_si128());
+    __m128i lo = _mm_and_si128(w, _mm_set1_epi32(0xffff));
+    __m128i hi = _mm_srli_epi32(w, 16);
+    __m128i r = _mm_or_si128(_mm_slli_epi32(lo, 4), hi);
+    r = _mm_packs_epi32(r, r);
+    r = _mm_packus_epi16(r, r);
+    int32_t v = _mm_cvtsi128_si32(r);
+    memcpy(o, &v, 4);
+}
+
+static inline void store4_cs4(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i w = interleave4_s16(vi, vq);
+    w = _mm_max_epi16(_mm_min_epi16(w, _mm_set1_epi16(0x7)), _mm_set1_epi16(-0x8));
+    __m128i lo = _mm_srai_epi32(_mm_slli_epi32(w, 16), 16);
+    __m128i hi = _mm_srai_epi32(w, 16);
+    __m128i r = _mm_or_si128(_mm_slli_epi32(lo, 4), _mm_and_si128(hi, _mm_set1_epi32(0xf)));
+    r = _mm_and_si128(r, _mm_set1_epi32(0xff));
+    r = _mm_packs_epi32(r, r);
+    r = _mm_packus_epi16(r, r);
+    int32_t v = _mm_cvtsi128_si32(r);
+    memcpy(o, &v, 4);
+}
+
+static inline void store4_cu8(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i w = interleave4_s16(vi, vq);
+    _mm_storel_epi64((__m128i *)o, _mm_packus_epi16(w, w));
+}
+
+static inline void store4_cs8(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i w = interleave4_s16(vi, vq);
+    _mm_storel_epi64((__m128i *)o, _mm_packs_epi16(w, w));
+}
+
+static inline void store4_12(uint8_t *o, __m128i w)
+{
+    // 24 bit (iiqIQQ) per sample: i[11:0] | q[11:0] << 12, little endian
+    __m128i m = _mm_set1_epi32(0xfff);
+    __m128i v = _mm_or_si128(_mm_and_si128(w, m), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 16), m), 12));
+    uint32_t u[4];
+    _mm_storeu_si128((__m128i *)u, v);
+    for (int k = 0; k < 4; ++k) {
+        *o++ = (uint8_t)(u[k]);
+        *o++ = (uint8_t)(u[k] >> 8);
+        *o++ = (uint8_t)(u[k] >> 16);
+    }
+}
+
+static inline void store4_cu12(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i bias = _mm_set1_epi32(0x8000);
+    vi = _mm_sub_epi32(clamp4_u16(vi), bias);
+    vq = _mm_sub_epi32(clamp4_u16(vq), bias);
+    store4_12(o, _mm_xor_si128(interleave4_s16(vi, vq), _mm_set1_epi16(-0x8000)));
+}
+
+static inline void store4_cs12(uint8_t *o, __m128i vi, __m128i vq)
+{
+    store4_12(o, interleave4_s16(vi, vq));
+}
+
+static inline void store4_cu16(uint8_t *o, __m128i vi, __m128i vq)
+{
+    __m128i bias = _mm_set1_epi32(0x8000);
+    vi = _mm_sub_epi32(clamp4_u16(vi), bias);
+    vq = _mm_sub_epi32(clamp4_u16(vq), bias);
+    __m128i w = _mm_xor_si128(interleave4_s16(vi, vq), _mm_set1_epi16(-0x8000));
+    _mm_storeu_si128((__m128i *)o, w);
+}
+
+static inline void store4_cs16(uint8_t *o, __m128i vi, __m128i vq)
+{
+    _mm_storeu_si128((__m128i *)o, interleave4_s16(vi, vq));
+}
+
+/// Store pre-clamped int32 lanes.
+static inline void store4_cs32(uint8_t *o, __m128i vi, __m128i vq)
+{
+    _mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi32(vi, vq));
+    _mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi32(vi, vq));
+}
+
+// SSE2 double: 4 samples per step
+
+/// (int)(x * s + b1 + b2) - off
+static inline __m128i cvt4_ma_sse2(double const *x, double s, double b1, double b2, int off)
+{
+    __m128d vs = _mm_set1_pd(s), v1 = _mm_set1_pd(b1), v2 = _mm_set1_pd(b2);
+    __m128d a  = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x), vs), v1), v2);
+    __m128d b  = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + 2), vs), v1), v2);
+    __m128i r  = _mm_unpacklo_epi64(_mm_cvttpd_epi32(a), _mm_cvttpd_epi32(b));
+    return _mm_sub_epi32(r, _mm_set1_epi32(off));
+}
+
+/// (int)((x + a) * s)
+static inline __m128i cvt4_am_sse2(double const *x, double a, double s)
+{
+    __m128d va = _mm_set1_pd(a), vs = _mm_set1_pd(s);
+    __m128d u  = _mm_mul_pd(_mm_add_pd(_mm_loadu_pd(x), va), vs);
+    __m128d v  = _mm_mul_pd(_mm_add_pd(_mm_loadu_pd(x + 2), va), vs);
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(u), _mm_cvttpd_epi32(v));
+}
+
+/// bound_s32(x * s), NaN propagates to the conversion like in bound_s32()
+static inline __m128i cvt4_s32_sse2(double const *x, double s)
+{
+    __m128d vs = _mm_set1_pd(s);
+    __m128d lo = _mm_set1_pd(-2147483647.0), hi = _mm_set1_pd(2147483647.0);
+    __m128d u  = _mm_min_pd(hi, _mm_max_pd(lo, _mm_mul_pd(_mm_loadu_pd(x), vs)));
+    __m128d v  = _mm_min_pd(hi, _mm_max_pd(lo, _mm_mul_pd(_mm_loadu_pd(x + 2), vs)));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(u), _mm_cvttpd_epi32(v));
+}
+
+// SSE2 float: 4 samples per step
+
+static inline __m128i cvt4_ma_sse2f(float const *x, float s, float b1, float b2, int off)
+{
+    __m128 a  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(s)), _mm_set1_ps(b1)), _mm_set1_ps(b2));
+    return _mm_sub_epi32(_mm_cvttps_epi32(a), _mm_set1_epi32(off));
+}
+
+static inline __m128i cvt4_am_sse2f(float const *x, float a, float s)
+{
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(x), _mm_set1_ps(a)), _mm_set1_ps(s)));
+}
+
+static inline __m128i cvt4_s32_sse2f(float const *x, float s)
+{
+    __m128 p   = _mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(s));
+    __m128d lo = _mm_set1_pd(-2147483647.0), hi = _mm_set1_pd(2147483647.0);
+    __m128d u  = _mm_min_pd(hi, _mm_max_pd(lo, _mm_cvtps_pd(p)));
+    __m128d v  = _mm_min_pd(hi, _mm_max_pd(lo, _mm_cvtps_pd(_mm_movehl_ps(p, p))));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(u), _mm_cvttpd_epi32(v));
+}
+
+// AVX2 double: 4 samples per step
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m128i cvt4_ma_avx2(double const *x, double s, double b1, double b2, int off)
+{
+    __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x), _mm256_set1_pd(s)), _mm256_set1_pd(b1)), _mm256_set1_pd(b2));
+    return _mm_sub_epi32(_mm256_cvttpd_epi32(a), _mm_set1_epi32(off));
+}
+
+static inline AVX2 __m128i cvt4_am_avx2(double const *x, double a, double s)
+{
+    return _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_add_pd(_mm256_loadu_pd(x), _mm256_set1_pd(a)), _mm256_set1_pd(s)));
+}
+
+static inline AVX2 __m128i cvt4_s32_avx2(double const *x, double s)
+{
+    __m256d lo = _mm256_set1_pd(-2147483647.0), hi = _mm256_set1_pd(2147483647.0);
+    return _mm256_cvttpd_epi32(_mm256_min_pd(hi, _mm256_max_pd(lo, _mm256_mul_pd(_mm256_loadu_pd(x), _mm256_set1_pd(s)))));
+}
+
+// AVX2 float: 8 samples per step, narrowed in two halves
+
+static inline AVX2 __m256i cvt8_ma_avx2f(float const *x, float s, float b1, float b2, int off)
+{
+    __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x), _mm256_set1_ps(s)), _mm256_set1_ps(b1)), _mm256_set1_ps(b2));
+    return _mm256_sub_epi32(_mm256_cvttps_epi32(a), _mm256_set1_epi32(off));
+}
+
+static inline AVX2 __m256i cvt8_am_avx2f(float const *x, float a, float s)
+{
+    return _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(x), _mm256_set1_ps(a)), _mm256_set1_ps(s)));
+}
+
+static inline AVX2 __m256i cvt8_s32_avx2f(float const *x, float s)
+{
+    __m256 p   = _mm256_mul_ps(_mm256_loadu_ps(x), _mm256_set1_ps(s));
+    __m256d lo = _mm256_set1_pd(-2147483647.0), hi = _mm256_set1_pd(2147483647.0);
+    __m128i a  = _mm256_cvttpd_epi32(_mm256_min_pd(hi, _mm256_max_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(p)))));
+    __m128i b  = _mm256_cvttpd_epi32(_mm256_min_pd(hi, _mm256_max_pd(lo, _mm256_cvtps_pd(_mm256_extractf128_ps(p, 1)))));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+}
+
+#define STORE8(name, unit) \
+    static inline AVX2 void store8_##name(uint8_t *o, __m256i vi, __m256i vq) \
+    { \
+        store4_##name(o, _mm256_castsi256_si128(vi), _mm256_castsi256_si128(vq)); \
+        store4_##name(o + 4 * (unit), _mm256_extracti128_si256(vi, 1), _mm256_extracti128_si256(vq, 1)); \
+    }
+
+STORE8(cu4, 1)
+STORE8(cs4, 1)
+STORE8(cu8, 2)
+STORE8(cs8, 2)
+STORE8(cu12, 3)
+STORE8(cs12, 3)
+STORE8(cu16, 4)
+STORE8(cs16, 4)
+STORE8(cs32, 8)
+
+/// Define a block converter: full steps with SIMD, the tail with the scalar converter.
+#define PACK_LOOP(attr, name, real_t, step, unit, cvt, store, tail) \
+    static attr void name(void *out, real_t const *i, real_t const *q, size_t len, real_t fs) \
+    { \
+        uint8_t *o = out; \
+        size_t t   = 0; \
+        for (; t + (step) <= len; t += (step)) { \
+            store(o + t * (unit), cvt(i + t), cvt(q + t)); \
+        } \
+        tail(o + t * (unit), i + t, q + t, len - t, fs); \
+    }
+
+#define CVT_CU4_SSE2(x) cvt4_ma_sse2(x, 7.999999, 7.5, 0.5, 0)
+#define CVT_CS4_SSE2(x) cvt4_ma_sse2(x, 7.49999, 8, 0.5, 8)
+#define CVT_CU8_SSE2(x) cvt4_ma_sse2(x, 127.999999, 127.5, 0.5, 0)
+#define CVT_CS8_SSE2(x) cvt4_ma_sse2(x, 127.4999, 128, 0.5, 128)
+#define CVT_CU16_SSE2(x) cvt4_am_sse2(x, 1.0, fs)
+#define CVT_CS12_SSE2(x) cvt4_ma_sse2(x, fs, 2048, 0.5, 2048)
+#define CVT_CS16_SSE2(x) cvt4_ma_sse2(x, fs, 32768, 0.5, 32768)
+#define CVT_CS32_SSE2(x) cvt4_s32_sse2(x, fs)
+
+PACK_LOOP(, pack_cu4_sse2, double, 4, 1, CVT_CU4_SSE2, store4_cu4, pack_cu4)
+PACK_LOOP(, pack_cs4_sse2, double, 4, 1, CVT_CS4_SSE2, store4_cs4, pack_cs4)
+PACK_LOOP(, pack_cu8_sse2, double, 4, 2, CVT_CU8_SSE2, store4_cu8, pack_cu8)
+PACK_LOOP(, pack_cs8_sse2, double, 4, 2, CVT_CS8_SSE2, store4_cs8, pack_cs8)
+PACK_LOOP(, pack_cu12_sse2, double, 4, 3, CVT_CU16_SSE2, store4_cu12, pack_cu12)
+PACK_LOOP(, pack_cs12_sse2, double, 4, 3, CVT_CS12_SSE2, store4_cs12, pack_cs12)
+PACK_LOOP(, pack_cu16_sse2, double, 4, 4, CVT_CU16_SSE2, store4_cu16, pack_cu16)
+PACK_LOOP(, pack_cs16_sse2, double, 4, 4, CVT_CS16_SSE2, store4_cs16, pack_cs16)
+PACK_LOOP(, pack_cs32_sse2, double, 4, 8, CVT_CS32_SSE2, store4_cs32, pack_cs32)
+
+#define CVT_CU4_AVX2(x) cvt4_ma_avx2(x, 7.999999, 7.5, 0.5, 0)
+#define CVT_CS4_AVX2(x) cvt4_ma_avx2(x, 7.49999, 8, 0.5, 8)
+#define CVT_CU8_AVX2(x) cvt4_ma_avx2(x, 127.999999, 127.5, 0.5, 0)
+#define CVT_CS8_AVX2(x) cvt4_ma_avx2(x, 127.4999, 128, 0.5, 128)
+#define CVT_CU16_AVX2(x) cvt4_am_avx2(x, 1.0, fs)
+#define CVT_CS12_AVX2(x) cvt4_ma_avx2(x, fs, 2048, 0.5, 2048)
+#define CVT_CS16_AVX2(x) cvt4_ma_avx2(x, fs, 32768, 0.5, 32768)
+#define CVT_CS32_AVX2(x) cvt4_s32_avx2(x, fs)
+
+PACK_LOOP(AVX2, pack_cu4_avx2, double, 4, 1, CVT_CU4_AVX2, store4_cu4, pack_cu4)
+PACK_LOOP(AVX2, pack_cs4_avx2, double, 4, 1, CVT_CS4_AVX2, store4_cs4, pack_cs4)
+PACK_LOOP(AVX2, pack_cu8_avx2, double, 4, 2, CVT_CU8_AVX2, store4_cu8, pack_cu8)
+PACK_LOOP(AVX2, pack_cs8_avx2, double, 4, 2, CVT_CS8_AVX2, store4_cs8, pack_cs8)
+PACK_LOOP(AVX2, pack_cu12_avx2, double, 4, 3, CVT_CU16_AVX2, store4_cu12, pack_cu12)
+PACK_LOOP(AVX2, pack_cs12_avx2, double, 4, 3, CVT_CS12_AVX2, store4_cs12, pack_cs12)
+PACK_LOOP(AVX2, pack_cu16_avx2, double, 4, 4, CVT_CU16_AVX2, store4_cu16, pack_cu16)
+PACK_LOOP(AVX2, pack_cs16_avx2, double, 4, 4, CVT_CS16_AVX2, store4_cs16, pack_cs16)
+PACK_LOOP(AVX2, pack_cs32_avx2, double, 4, 8, CVT_CS32_AVX2, store4_cs32, pack_cs32)
+
+#define CVT_CU4_SSE2F(x) cvt4_ma_sse2f(x, 7.999999f, 7.5f, 0.5f, 0)
+#define CVT_CS4_SSE2F(x) cvt4_ma_sse2f(x, 7.49999f, 8.0f, 0.5f, 8)
+#define CVT_CU8_SSE2F(x) cvt4_ma_sse2f(x, 127.999999f, 127.5f, 0.5f, 0)
+#define CVT_CS8_SSE2F(x) cvt4_ma_sse2f(x, 127.4999f, 128.0f, 0.5f, 128)
+#define CVT_CU16_SSE2F(x) cvt4_am_sse2f(x, 1.0f, fs)
+#define CVT_CS12_SSE2F(x) cvt4_ma_sse2f(x, fs, 2048.0f, 0.5f, 2048)
+#define CVT_CS16_SSE2F(x) cvt4_ma_sse2f(x, fs, 32768.0f, 0.5f, 32768)
+#define CVT_CS32_SSE2F(x) cvt4_s32_sse2f(x, fs)
+
+PACK_LOOP(, packf_cu4_sse2, float, 4, 1, CVT_CU4_SSE2F, store4_cu4, packf_cu4)
+PACK_LOOP(, packf_cs4_sse2, float, 4, 1, CVT_CS4_SSE2F, store4_cs4, packf_cs4)
+PACK_LOOP(, packf_cu8_sse2, float, 4, 2, CVT_CU8_SSE2F, store4_cu8, packf_cu8)
+PACK_LOOP(, packf_cs8_sse2, float, 4, 2, CVT_CS8_SSE2F, store4_cs8, packf_cs8)
+PACK_LOOP(, packf_cu12_sse2, float, 4, 3, CVT_CU16_SSE2F, store4_cu12, packf_cu12)
+PACK_LOOP(, packf_cs12_sse2, float, 4, 3, CVT_CS12_SSE2F, store4_cs12, packf_cs12)
+PACK_LOOP(, packf_cu16_sse2, float, 4, 4, CVT_CU16_SSE2F, store4_cu16, packf_cu16)
+PACK_LOOP(, packf_cs16_sse2, float, 4, 4, CVT_CS16_SSE2F, store4_cs16, packf_cs16)
+PACK_LOOP(, packf_cs32_sse2, float, 4, 8, CVT_CS32_SSE2F, store4_cs32, packf_cs32)
+
+#define CVT_CU4_AVX2F(x) cvt8_ma_avx2f(x, 7.999999f, 7.5f, 0.5f, 0)
+#define CVT_CS4_AVX2F(x) cvt8_ma_avx2f(x, 7.49999f, 8.0f, 0.5f, 8)
+#define CVT_CU8_AVX2F(x) cvt8_ma_avx2f(x, 127.999999f, 127.5f, 0.5f, 0)
+#define CVT_CS8_AVX2F(x) cvt8_ma_avx2f(x, 127.4999f, 128.0f, 0.5f, 128)
+#define CVT_CU16_AVX2F(x) cvt8_am_avx2f(x, 1.0f, fs)
+#define CVT_CS12_AVX2F(x) cvt8_ma_avx2f(x, fs, 2048.0f, 0.5f, 2048)
+#define CVT_CS16_AVX2F(x) cvt8_ma_avx2f(x, fs, 32768.0f, 0.5f, 32768)
+#define CVT_CS32_AVX2F(x) cvt8_s32_avx2f(x, fs)
+
+PACK_LOOP(AVX2, packf_cu4_avx2, float, 8, 1, CVT_CU4_AVX2F, store8_cu4, packf_cu4)
+PACK_LOOP(AVX2, packf_cs4_avx2, float, 8, 1, CVT_CS4_AVX2F, store8_cs4, packf_cs4)
+PACK_LOOP(AVX2, packf_cu8_avx2, float, 8, 2, CVT_CU8_AVX2F, store8_cu8, packf_cu8)
+PACK_LOOP(AVX2, packf_cs8_avx2, float, 8, 2, CVT_CS8_AVX2F, store8_cs8, packf_cs8)
+PACK_LOOP(AVX2, packf_cu12_avx2, float, 8, 3, CVT_CU16_AVX2F, store8_cu12, packf_cu12)
+PACK_LOOP(AVX2, packf_cs12_avx2, float, 8, 3, CVT_CS12_AVX2F, store8_cs12, packf_cs12)
+PACK_LOOP(AVX2, packf_cu16_avx2, float, 8, 4, CVT_CU16_AVX2F, store8_cu16, packf_cu16)
+PACK_LOOP(AVX2, packf_cs16_avx2, float, 8, 4, CVT_CS16_AVX2F, store8_cs16, packf_cs16)
+PACK_LOOP(AVX2, packf_cs32_avx2, float, 8, 8, CVT_CS32_AVX2F, store8_cs32, packf_cs32)
+
+// float formats need no narrowing, only scale and interleave
+
+static void pack_cf32_sse2(void *out, double const *i, double const *q, size_t len, double fs)
+{
+    float *o  = out;
+    size_t t  = 0;
+    __m128d s = _mm_set1_pd(fs);
+    __m128 z  = _mm_setzero_ps(); // no -0.0f, see pack_cf32()
+    for (; t + 4 <= len; t += 4) {
+        __m128 fi = _mm_add_ps(_mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(i + t), s)), _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(i + t + 2), s))), z);
+        __m128 fq = _mm_add_ps(_mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(q + t), s)), _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(q + t + 2), s))), z);
+        _mm_storeu_ps(o + 2 * t, _mm_unpacklo_ps(fi, fq));
+        _mm_storeu_ps(o + 2 * t + 4, _mm_unpackhi_ps(fi, fq));
+    }
+    pack_cf32(o + 2 * t, i + t, q + t, len - t, fs);
+}
+
+static AVX2 void pack_cf32_avx2(void *out, double const *i, double const *q, size_t len, double fs)
+{
+    float *o  = out;
+    size_t t  = 0;
+    __m256d s = _mm256_set1_pd(fs);
+    __m128 z  = _mm_setzero_ps(); // no -0.0f, see pack_cf32()
+    for (; t + 4 <= len; t += 4) {
+        __m128 fi = _mm_add_ps(_mm256_cvtpd_ps(_mm256_mul_pd(_mm256_loadu_pd(i + t), s)), z);
+        __m128 fq = _mm_add_ps(_mm256_cvtpd_ps(_mm256_mul_pd(_mm256_loadu_pd(q + t), s)), z);
+        _mm_storeu_ps(o + 2 * t, _mm_unpacklo_ps(fi, fq));
+        _mm_storeu_ps(o + 2 * t + 4, _mm_unpackhi_ps(fi, fq));
+    }
+    pack_cf32(o + 2 * t, i + t, q + t, len - t, fs);
+}
+
+static void pack_cf64_sse2(void *out, double const *i, double const *q, size_t len, double fs)
+{
+    double *o = out;
+    size_t t  = 0;
+    __m128d s = _mm_set1_pd(fs);
+    for (; t + 2 <= len; t += 2) {
+        __m128d di = _mm_mul_pd(_mm_loadu_pd(i + t), s);
+        __m128d dq = _mm_mul_pd(_mm_loadu_pd(q + t), s);
+        _mm_storeu_pd(o + 2 * t, _mm_unpacklo_pd(di, dq));
+        _mm_storeu_pd(o + 2 * t + 2, _mm_unpackhi_pd(di, dq));
+    }
+    pack_cf64(o + 2 * t, i + t, q + t, len - t, fs);
+}
+
+static void packf_cf32_sse2(void *out, float const *i, float const *q, size_t len, float fs)
+{
+    float *o = out;
+    size_t t = 0;
+    __m128 s = _mm_set1_ps(fs);
+    for (; t + 4 <= len; t += 4) {
+        __m128 fi = _mm_mul_ps(_mm_loadu_ps(i + t), s);
+        __m128 fq = _mm_mul_ps(_mm_loadu_ps(q + t), s);
+        _mm_storeu_ps(o + 2 * t, _mm_unpacklo_ps(fi, fq));
+        _mm_storeu_ps(o + 2 * t + 4, _mm_unpackhi_ps(fi, fq));
+    }
+    packf_cf32(o + 2 * t, i + t, q + t, len - t, fs);
+}
+
+#endif /* HAS_X86_SIMD */
+
+// dispatch
+
+enum pack_isa {
+    PACK_ISA_SCALAR,
+    PACK_ISA_SSE2,
+    PACK_ISA_AVX2,
+};
+
+static sample_pack_fn pack_scalar[] = {
+        pack_cu8,
+        pack_cu4,
+        pack_cs4,
+        pack_cu8,
+        pack_cs8,
+        pack_cu12,
+        pack_cs12,
+        pack_cu16,
+        pack_cs16,
+        pack_cu32,
+        pack_cs32,
+        pack_cu64,
+        pack_cs64,
+        pack_cf32,
+        pack_cf64,
+};
+
+static sample_packf_fn packf_scalar[] = {
+        packf_cu8,
+        packf_cu4,
+        packf_cs4,
+        packf_cu8,
+        packf_cs8,
+        packf_cu12,
+        packf_cs12,
+        packf_cu16,
+        packf_cs16,
+        packf_cu32,
+        packf_cs32,
+        packf_cu64,
+        packf_cs64,
+        packf_cf32,
+        packf_cf64,
+};
+
+#ifdef HAS_X86_SIMD
+// 64-bit integer and CU32 lanes have no packed conversion below AVX-512, those stay scalar
+static sample_pack_fn pack_sse2[] = {
+        pack_cu8_sse2,
+        pack_cu4_sse2,
+        pack_cs4_sse2,
+        pack_cu8_sse2,
+        pack_cs8_sse2,
+        pack_cu12_sse2,
+        pack_cs12_sse2,
+        pack_cu16_sse2,
+        pack_cs16_sse2,
+        pack_cu32,
+        pack_cs32_sse2,
+        pack_cu64,
+        pack_cs64,
+        pack_cf32_sse2,
+        pack_cf64_sse2,
+};
+
+static sample_pack_fn pack_avx2[] = {
+        pack_cu8_avx2,
+        pack_cu4_avx2,
+        pack_cs4_avx2,
+        pack_cu8_avx2,
+        pack_cs8_avx2,
+        pack_cu12_avx2,
+        pack_cs12_avx2,
+        pack_cu16_avx2,
+        pack_cs16_avx2,
+        pack_cu32,
+        pack_cs32_avx2,
+        pack_cu64,
+        pack_cs64,
+        pack_cf32_avx2,
+        pack_cf64_sse2,
+};
+
+static sample_packf_fn packf_sse2[] = {
+        packf_cu8_sse2,
+        packf_cu4_sse2,
+        packf_cs4_sse2,
+        packf_cu8_sse2,
+        packf_cs8_sse2,
+        packf_cu12_sse2,
+        packf_cs12_sse2,
+        packf_cu16_sse2,
+        packf_cs16_sse2,
+        packf_cu32,
+        packf_cs32_sse2,
+        packf_cu64,
+        packf_cs64,
+        packf_cf32_sse2,
+        packf_cf64,
+};
+
+static sample_packf_fn packf_avx2[] = {
+        packf_cu8_avx2,
+        packf_cu4_avx2,
+        packf_cs4_avx2,
+        packf_cu8_avx2,
+        packf_cs8_avx2,
+        packf_cu12_avx2,
+        packf_cs12_avx2,
+        packf_cu16_avx2,
+        packf_cs16_avx2,
+        packf_cu32,
+        packf_cs32_avx2,
+        packf_cu64,
+        packf_cs64,
+        packf_cf32_sse2,
+        packf_cf64,
+};
+#endif
+
+static enum pack_isa pack_isa_detect(void)
+{
+#ifdef HAS_X86_SIMD
+    // cpuid based, also checks OS support for the AVX state
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PACK_ISA_AVX2;
+    return PACK_ISA_SSE2;
+#else
+    return PACK_ISA_SCALAR;
+#endif
+}
+
+static enum pack_isa isa_detected;
+static pthread_once_t isa_once = PTHREAD_ONCE_INIT;
+
+static void pack_isa_init(void)
+{
+    isa_detected = pack_isa_detect();
+}
+
+static enum pack_isa pack_isa(void)
+{
+    pthread_once(&isa_once, pack_isa_init);
+    return isa_detected;
+}
+
+sample_pack_fn sample_pack_for(enum sample_format format)
+{
+    if (format < FORMAT_NONE || format > FORMAT_CF64)
+        return NULL;
+#ifdef HAS_X86_SIMD
+    if (pack_isa() == PACK_ISA_AVX2)
+        return pack_avx2[format];
+    if (pack_isa() == PACK_ISA_SSE2)
+        return pack_sse2[format];
+#endif
+    return pack_scalar[format];
+}
+
+sample_packf_fn sample_packf_for(enum sample_format format)
+{
+    if (format < FORMAT_NONE || format > FORMAT_CF64)
+        return NULL;
+#ifdef HAS_X86_SIMD
+    if (pack_isa() == PACK_ISA_AVX2)
+        return packf_avx2[format];
+    if (pack_isa() == PACK_ISA_SSE2)
+        return packf_sse2[format];
+#endif
+    return packf_scalar[format];
+}
+
+sample_packq_fn sample_packq_for(enum sample_format format)
+{
+    if (format == FORMAT_CS8)
+        return packq_cs8;
+    if (format == FORMAT_CS16)
+        return packq_cs16;
+    return NULL;
+}
+
+char const *sample_pack_isa(void)
+{
+    switch (pack_isa()) {
+    case PACK_ISA_AVX2:
+        return "avx2";
+    case PACK_ISA_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,50 @@
+/** @file
+    tx_tools - sample_pack, convert I/Q blocks to sample formats.
+
+    Copyright (C) 2019 by Christian Zuckschwerdt <zany@triq.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_SAMPLEPACK_H_
+#define INCLUDE_SAMPLEPACK_H_
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* int32_t */
+#include "sample.h" /* sample_format_t */
+
+/// Convert len I/Q doubles to the packed sample format at out.
+/// The output needs room for len * sample_format_length() bytes.
+typedef void (*sample_pack_fn)(void *out, double const *i, double const *q, size_t len, double full_scale);
+
+/// Convert len I/Q floats to the packed sample format at out.
+typedef void (*sample_packf_fn)(void *out, float const *i, float const *q, size_t len, float full_scale);
+
+/// Convert len I/Q Q15 values (32768 is 1.0) to the packed sample format at out, saturating.
+/// The scale is the full scale in Q15.
+typedef void (*sample_packq_fn)(void *out, int32_t const *i, int32_t const *q, size_t len, int32_t scale);
+
+/// Get the fastest packer for a format, CPU features are detected on first use.
+sample_pack_fn sample_pack_for(enum sample_format format);
+
+/// Get the fastest float packer for a format, CPU features are detected on first use.
+sample_packf_fn sample_packf_for(enum sample_format format);
+
+/// Get the fixed point packer for a format, only CS8 and CS16 are supported, otherwise NULL.
+sample_packq_fn sample_packq_for(enum sample_format format);
+
+/// Name of the instruction set the packers use ("avx2", "sse2", or "scalar").
+char const *sample_pack_isa(void);
+
+#endif /* INCLUDE_SAMPLEPACK_H_ */
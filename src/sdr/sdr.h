@@ -82,6 +82,10 @@ typedef struct sdr_cmd {
     void *stream_buffer;
     size_t buffer_offset;
     size_t buffer_size;
+    // input from callback, e.g. a renderer
+    size_t (*input_read)(void *input_ctx, void *buf, size_t len); ///< pull up to len samples, returns less only at the end
+    void (*input_rewind)(void *input_ctx);                         ///< restart the input, for loops
+    void *input_ctx;
     // private
     double fullScale;
     int flag_abort; ///< private
@@ -306,7 +306,11 @@ int sdr_tx_free(sdr_ctx_t *sdr_ctx, sdr_cmd_t *tx)
 
 int sdr_input_reset(sdr_ctx_t *sdr_ctx, sdr_cmd_t *tx)
 {
-    if (tx->stream_fd >= 0) {
+    if (tx->input_read) {
+        if (tx->input_rewind)
+            tx->input_rewind(tx->input_ctx);
+    }
+    else if (tx->stream_fd >= 0) {
         lseek(tx->stream_fd, 0, SEEK_SET);
     }
     else {
@@ -375,6 +379,14 @@ ssize_t sdr_input_try_read(sdr_ctx_t *sdr_ctx, sdr_cmd_t *tx, void *buf, size_t
         return -2;
     }
 
+    // pull from callback
+
+    if (tx->input_read) {
+        size_t n_samps = tx->input_read(tx->input_ctx, buf, tx->block_size);
+        *out_samps     = n_samps;
+        return (ssize_t)(n_samps * sizeof(int16_t) * 2);
+    }
+
     // read from buffer
 
     if (!tx->stream_fd) {
@@ -159,6 +159,7 @@ int tx_transmit(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
     }
     r = sdr_tx((sdr_ctx_t *)tx_ctx, (sdr_cmd_t *)tx);
     sdr_tx_free((sdr_ctx_t *)tx_ctx, (sdr_cmd_t *)tx);
+    tx_input_free(tx);
     return r;
 }
 
@@ -192,6 +193,8 @@ void tx_print(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
     printf("  input from buffer\n");
     printf("    stream_buffer=%p\n", tx->stream_buffer);
     printf("    buffer_size=%zu\n", tx->buffer_size);
+    printf("  input from callback\n");
+    printf("    input_ctx=%p\n", tx->input_ctx);
     printf("  input from text\n");
     printf("    freq_mark=%i\n", tx->freq_mark);
     printf("    freq_space=%i\n", tx->freq_space);
@@ -216,6 +219,27 @@ void tx_cmd_free(tx_cmd_t *tx)
 
 // input processing
 
+static size_t tx_render_read(void *input_ctx, void *buf, size_t len)
+{
+    return iq_render_read(input_ctx, buf, len);
+}
+
+static void tx_render_rewind(void *input_ctx)
+{
+    iq_render_rewind(input_ctx);
+}
+
+/// Pull samples from a renderer on demand.
+static int tx_render_input(tx_cmd_t *tx, iq_render_t *spec, tone_t *tones)
+{
+    tx->input_ctx = iq_render_open(spec, tones);
+    if (!tx->input_ctx)
+        return -1;
+    tx->input_read   = tx_render_read;
+    tx->input_rewind = tx_render_rewind;
+    return 0;
+}
+
 int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
 {
     // unpack codes if requested
@@ -224,6 +248,7 @@ int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
         iq_render_defaults(&iq_render);
         iq_render.sample_rate   = tx->sample_rate;
         iq_render.sample_format = sample_format_for(tx->output_format);
+        iq_render.flag_abort    = &tx->flag_abort;
 
         symbol_t *symbols = NULL;
         preset_t *preset  = NULL;
@@ -237,10 +262,10 @@ int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
         symbols = parse_code(tx->codes, symbols);
         output_symbol(symbols); // debug
 
-        iq_render_buf(&iq_render, symbols->tone, &tx->stream_buffer, &tx->buffer_size);
+        int r = tx_render_input(tx, &iq_render, symbols->tone);
         free(symbols);
 
-        return 0;
+        return r;
     }
 
     // unpack pulses if requested
@@ -249,6 +274,7 @@ int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
         iq_render_defaults(&iq_render);
         iq_render.sample_rate   = tx->sample_rate;
         iq_render.sample_format = sample_format_for(tx->output_format);
+        iq_render.flag_abort    = &tx->flag_abort;
 
         pulse_setup_t pulse_setup = {0};
         pulse_setup_defaults(&pulse_setup, "OOK");
@@ -262,10 +288,10 @@ int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
         tone_t *tones = parse_pulses(tx->pulses, &pulse_setup);
         output_pulses(tones); // debug
 
-        iq_render_buf(&iq_render, tones, &tx->stream_buffer, &tx->buffer_size);
+        int r = tx_render_input(tx, &iq_render, tones);
         free(tones);
 
-        return 0;
+        return r;
     }
 
     // otherwise: setup stream conversion
@@ -290,3 +316,12 @@ int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx)
 
     return 0;
 }
+
+void tx_input_free(tx_cmd_t *tx)
+{
+    if (tx->input_read == tx_render_read)
+        iq_render_close(tx->input_ctx);
+    tx->input_read   = NULL;
+    tx->input_rewind = NULL;
+    tx->input_ctx    = NULL;
+}
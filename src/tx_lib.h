@@ -78,6 +78,10 @@ typedef struct tx_cmd {
     void *stream_buffer;
     size_t buffer_offset;
     size_t buffer_size;
+    // input from callback, e.g. a renderer
+    size_t (*input_read)(void *input_ctx, void *buf, size_t len); ///< pull up to len samples, returns less only at the end
+    void (*input_rewind)(void *input_ctx);                         ///< restart the input, for loops
+    void *input_ctx;
     // private
     double fullScale;
     int flag_abort; ///< private
@@ -148,4 +152,7 @@ preset_t *tx_presets_get(tx_ctx_t *tx_ctx, char const *name);
 /// Prepare input data.
 int tx_input_init(tx_ctx_t *tx_ctx, tx_cmd_t *tx);
 
+/// Release input data.
+void tx_input_free(tx_cmd_t *tx);
+
 #endif /* INCLUDE_TXLIB_H_ */